@@ -0,0 +1,164 @@
+//      _
+//     / \   _ __ ___ _ __   __ _
+//    / _ \ | '__/ _ \ '_ \ / _` |
+//   / ___ \| | |  __/ | | | (_| |
+//  /_/   \_\_|  \___|_| |_|\__,_|
+
+#include "arena.h"
+#include <stddef.h>
+
+//   ____            _                 _   _
+//  |  _ \  ___  ___| | __ _ _ __ __ _| |_(_) ___  _ __  ___
+//  | | | |/ _ \/ __| |/ _` | '__/ _` | __| |/ _ \| '_ \/ __|
+//  | |_| |  __/ (__| | (_| | | | (_| | |_| | (_) | | | \__ \
+//  |____/ \___|\___|_|\__,_|_|  \__,_|\__|_|\___/|_| |_|___/
+
+#define ARENA_CHUNK (256 * 1024)
+#define ARENA_ALIGN (_Alignof(max_align_t))
+
+// A chunk of memory; data follows the header
+typedef struct chunk {
+  struct chunk *next; // previous chunk (singly linked list)
+  size_t size;        // usable bytes in data
+  size_t used;        // bytes already allocated
+  max_align_t data[]; // the memory (aligned as max_align_t)
+} chunk_t;
+
+// Arena object structure
+typedef struct arena {
+  chunk_t *head;     // current chunk (the most recent)
+  size_t chunk_size; // default chunk size
+  size_t count;      // number of allocated objects
+  size_t chunks;     // number of chunks
+  size_t size;       // total bytes in chunks
+} arena_t;
+
+// STATIC FUNCTIONS (for internal use only) ====================================
+static chunk_t *arena_grow(arena_t *a, size_t size);
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+arena_t *arena_new(size_t chunk_size) {
+  arena_t *a = (arena_t *)calloc(1, sizeof(arena_t));
+  if (!a) {
+    perror("Could not create arena");
+    return NULL;
+  }
+  a->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK;
+  return a;
+}
+
+void arena_free(arena_t *a) {
+  assert(a);
+  chunk_t *c, *tmp;
+  c = a->head;
+  while (c) {
+    tmp = c;
+    c = c->next;
+    free(tmp);
+  }
+  free(a);
+  a = NULL;
+}
+
+void arena_adopt(arena_t *dst, arena_t *src) {
+  assert(dst && src);
+  chunk_t *c = src->head;
+  if (c) {
+    // append dst chunks after src ones, so that the current chunk of dst
+    // keeps being the head
+    while (c->next)
+      c = c->next;
+    c->next = dst->head ? dst->head->next : NULL;
+    if (dst->head) {
+      dst->head->next = src->head;
+    }
+    else {
+      dst->head = src->head;
+    }
+  }
+  dst->count += src->count;
+  dst->chunks += src->chunks;
+  dst->size += src->size;
+  src->head = NULL;
+  arena_free(src);
+}
+
+
+// ALLOCATION ==================================================================
+
+void *arena_alloc(arena_t *a, size_t size) {
+  assert(a);
+  chunk_t *c = a->head;
+  void *ptr;
+  // round up to keep the next allocation aligned
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  if (!c || c->used + size > c->size) {
+    if (!(c = arena_grow(a, size)))
+      return NULL;
+  }
+  // chunks are calloc'ed and never reused, so memory is already zeroed
+  ptr = (char *)c->data + c->used;
+  c->used += size;
+  a->count++;
+  return ptr;
+}
+
+char *arena_strdup(arena_t *a, const char *s) {
+  assert(s);
+  return arena_strndup(a, s, strlen(s));
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t n) {
+  assert(a && s);
+  char *d;
+  n = strnlen(s, n);
+  if (!(d = (char *)arena_alloc(a, n + 1)))
+    return NULL;
+  memcpy(d, s, n);
+  d[n] = '\0';
+  return d;
+}
+
+
+// GETTERS =====================================================================
+
+#define arena_getter(typ, par, name) \
+typ arena_##name(const arena_t *a) { assert(a); return a->par; }
+
+arena_getter(size_t, count, count);
+arena_getter(size_t, chunks, chunks);
+arena_getter(size_t, size, size);
+
+
+
+//   ____  _        _   _         __
+//  / ___|| |_ __ _| |_(_) ___   / _|_   _ _ __   ___
+//  \___ \| __/ _` | __| |/ __| | |_| | | | '_ \ / __|
+//   ___) | || (_| | |_| | (__  |  _| |_| | | | | (__
+//  |____/ \__\__,_|\__|_|\___| |_|  \__,_|_| |_|\___|
+// Definitions for the static functions declared above
+
+// Add a new chunk that can hold at least size bytes
+static chunk_t *arena_grow(arena_t *a, size_t size) {
+  size_t n = MAX(size, a->chunk_size);
+  chunk_t *c = (chunk_t *)calloc(1, sizeof(chunk_t) + n);
+  if (!c) {
+    perror("Could not allocate arena chunk");
+    return NULL;
+  }
+  c->size = n;
+  c->used = 0;
+  c->next = a->head;
+  a->head = c;
+  a->chunks++;
+  a->size += n;
+  return c;
+}
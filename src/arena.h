@@ -0,0 +1,65 @@
+//      _
+//     / \   _ __ ___ _ __   __ _
+//    / _ \ | '__/ _ \ '_ \ / _` |
+//   / ___ \| | |  __/ | | | (_| |
+//  /_/   \_\_|  \___|_| |_|\__,_|
+//  Arena allocator
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "defines.h"
+
+//   _____                      
+//  |_   _|   _ _ __   ___  ___ 
+//    | || | | | '_ \ / _ \/ __|
+//    | || |_| | |_) |  __/\__ \
+//    |_| \__, | .__/ \___||___/
+//        |___/|_|              
+
+// Opaque structure: a list of large memory chunks, from which objects are
+// allocated by bumping a pointer. Objects cannot be freed one by one: they
+// are all released at once together with the arena.
+// An arena is NOT thread safe: use one arena per thread.
+typedef struct arena arena_t;
+
+
+//   _____                 _   _                 
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___ 
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+// Create an arena allocating chunk_size bytes at a time (0 for default)
+arena_t *arena_new(size_t chunk_size);
+
+// Release all the objects allocated in the arena, and the arena itself
+void arena_free(arena_t *a);
+
+// Move all the chunks of src into dst, then free src
+void arena_adopt(arena_t *dst, arena_t *src);
+
+// ALLOCATION ==================================================================
+
+// Allocate size bytes, zero initialized and suitably aligned for any type
+void *arena_alloc(arena_t *a, size_t size);
+
+// Copy strings into the arena
+char *arena_strdup(arena_t *a, const char *s);
+char *arena_strndup(arena_t *a, const char *s, size_t n);
+
+// GETTERS =====================================================================
+
+// Number of objects allocated so far
+size_t arena_count(const arena_t *a);
+
+// Number of chunks (i.e. of malloc calls) so far
+size_t arena_chunks(const arena_t *a);
+
+// Total memory allocated in chunks
+size_t arena_size(const arena_t *a);
+
+
+#endif // ARENA_H
@@ -5,7 +5,9 @@
 //  |____/|_|\___/ \___|_|\_\
 
 #include "block.h"
-#include <ctype.h>
+#include "compiled.h"
+#include "kernel.h"
+#include "lexer.h"
 
 //   ____            _                 _   _
 //  |  _ \  ___  ___| | __ _ _ __ __ _| |_(_) ___  _ __  ___
@@ -13,25 +15,32 @@
 //  | |_| |  __/ (__| | (_| | | | (_| | |_| | (_) | | | \__ \
 //  |____/ \___|\___|_|\__,_|_|  \__,_|\__|_|\___/|_| |_|___/
 
-// Trapezoidal velocity profile
-typedef struct {
-  data_t a, d;             // acceleration
-  data_t f, l;             // feedrate and length
-  data_t dt_1, dt_m, dt_2; // trapezoid times
-  data_t dt;               // total time
-} block_profile_t;
+// Mnemonics for the set bitmask: the remaining modal fields are inherited
+// from the previous block
+#define N_SET '\1'
+#define F_SET '\2'
+#define S_SET '\4'
+#define T_SET '\10'
+
+// Min number of G01 blocks replaced by an arc in block_fit_arc (three points
+// always lie on a circle, so at least one more is needed as a check)
+#define ARC_MIN_BLOCKS 3
 
 // Block object structure
 typedef struct block {
   char *line;            // G-code line
+  int own_line;          // true if line has been copied (and must be freed)
+  arena_t *arena;        // arena owning the block memory (or NULL)
+  uint8_t set;           // modal fields explicitly given in the line
   block_type_t type;     // type of block
   size_t n;              // block number
   size_t tool;           // tool number
-  data_t feedrate;       // feedrate
+  data_t feedrate;       // feedrate (as programmed, modal)
+  data_t feed;           // actual feedrate
   data_t spindle;        // spindle rate
-  point_t *target;       // destination point
-  point_t *delta;        // distance vector w.r.t. previous point
-  point_t *center;       // arc center (if it is an arc)
+  point_t target;        // destination point
+  point_t delta;         // distance vector w.r.t. previous point
+  point_t center;        // arc center (if it is an arc)
   data_t length;         // total length
   data_t i, j, r;        // center coordinates and radius (if it is an arc)
   data_t theta0, dtheta; // arc initial angle and arc angle
@@ -43,11 +52,28 @@ typedef struct block {
 } block_t;
 
 // STATIC FUNCTIONS (for internal use only) ====================================
-static int block_set_fields(block_t *b, char cmd, char *arg);
-static point_t *point_zero(block_t *b);
+static block_t *block_init(char *line, block_t *prev, machine_t *cfg,
+                           arena_t *arena);
+static void block_clear(block_t *b, char *line, machine_t *cfg);
+static int block_set_fields(block_t *b, char cmd, data_t arg);
+static int word_index(char cmd, data_t arg, size_t *val);
+static point_t point_zero(const block_t *b);
 static void block_compute(block_t *b);
+static void block_compute_s(block_t *b);
 static int block_arc(block_t *b);
+static int block_is_feed(const block_t *b);
+static void block_sampler_phase(block_sampler_t *s);
+static void block_direction(const block_t *b, data_t lambda, data_t u[3]);
 static data_t quantize(data_t t, data_t tq, data_t *dq);
+static data_t segment_distance(point_t a, point_t b, point_t p, data_t *u);
+static int circle_through(point_t a, point_t m, point_t c, point_t *center,
+                          data_t *r);
+static data_t arc_fits(const block_t *b, const block_t *c, point_t center,
+                       data_t r, int dir, data_t tol);
+static data_t ramp_time(data_t dv, data_t A, data_t J, data_t *tj);
+static data_t ramp_length(data_t v0, data_t v1, data_t A, data_t J);
+static data_t ramp_eval(data_t v0, data_t a, data_t tj, data_t T, data_t t,
+                        data_t *v);
 
 //   _____                 _   _
 //  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
@@ -59,74 +85,110 @@ static data_t quantize(data_t t, data_t tq, data_t *dq);
 
 block_t *block_new(const char *line, block_t *prev, machine_t *cfg) {
   assert(line && cfg); // prev is NULL if this is the first block
-  block_t *b = (block_t *)calloc(1, sizeof(block_t));
-  if (!b) {
-    perror("Could not allocate block");
+  block_t *b;
+  char *copy = strdup(line);
+  if (!copy) {
+    perror("Could not allocate line");
     return NULL;
   }
-
-  if (prev) { // copy the memory from the previous block
-    memcpy(b, prev, sizeof(block_t));
-    b->prev = prev;
-    prev->next = b;
-  } else { // this is the first block
-    // nothing to do
+  if (!(b = block_init(copy, prev, cfg, NULL))) {
+    free(copy);
+    return NULL;
   }
+  b->own_line = 1;
+  return b;
+}
 
-  // non-modal g-code parameters: I, J, R
-  b->i = b->j = b->r = 0.0;
+block_t *block_new_ref(char *line, block_t *prev, machine_t *cfg) {
+  assert(line && cfg);
+  return block_init(line, prev, cfg, NULL);
+}
 
-  // fields to be calculated
-  b->length = 0.0;
-  b->target = point_new();
-  b->delta = point_new();
-  b->center = point_new();
+block_t *block_new_in(arena_t *a, char *line, block_t *prev, machine_t *cfg) {
+  assert(a && line && cfg);
+  return block_init(line, prev, cfg, a);
+}
 
-  // allocate memory for profile struct
-  b->prof = (block_profile_t *)calloc(1, sizeof(block_profile_t));
-  if (!b->prof) {
-    perror("Could not allocate profile structure");
+block_t *block_restore(const compiled_t *c, size_t i, arena_t *a,
+                       char *line, block_t *prev, machine_t *cfg) {
+  assert(c && i < compiled_count(c));
+  block_t *b = block_new_in(a, line, prev, cfg);
+  if (!b)
     return NULL;
+  b->type = (block_type_t)compiled_type(c)[i];
+  b->n = compiled_n(c)[i];
+  b->tool = compiled_tool(c)[i];
+  b->feedrate = compiled_feedrate(c)[i];
+  b->feed = compiled_feed(c)[i];
+  b->spindle = compiled_spindle(c)[i];
+  b->target = point_v(compiled_x(c)[i], compiled_y(c)[i], compiled_z(c)[i]);
+  b->delta = point_v(compiled_dx(c)[i], compiled_dy(c)[i], compiled_dz(c)[i]);
+  if (b->type == ARC_CW || b->type == ARC_CCW) {
+    b->center = point_with_x(b->center, compiled_cx(c)[i]);
+    b->center = point_with_y(b->center, compiled_cy(c)[i]);
   }
+  b->length = compiled_length(c)[i];
+  b->r = compiled_r(c)[i];
+  b->theta0 = compiled_theta0(c)[i];
+  b->dtheta = compiled_dtheta(c)[i];
+  b->acc = compiled_acc(c)[i];
+  *b->prof = compiled_profile(c)[i];
+  return b;
+}
 
-  b->machine = cfg;
-  b->type = NO_MOTION;
-  b->acc = machine_A(b->machine);
-  b->line = strdup(line);
-  if (! b->line) {
-    perror("Could not allocate line");
-    return NULL;
+void block_recycle(block_t *b, char *line, block_t *prev) {
+  assert(b && line && !b->arena);
+  block_profile_t *prof = b->prof;
+  machine_t *cfg = b->machine;
+  // unlink from the old neighbors
+  if (b->next && b->next->prev == b)
+    b->next->prev = NULL;
+  if (b->prev && b->prev->next == b)
+    b->prev->next = NULL;
+  if (b->line && b->own_line)
+    free(b->line);
+  // same as block_init, keeping the profile struct
+  if (prev) {
+    memcpy(b, prev, sizeof(block_t));
+    b->prev = prev;
+    prev->next = b;
   }
-
-  return b;
+  else {
+    memset(b, 0, sizeof(block_t));
+  }
+  b->next = NULL;
+  b->arena = NULL;
+  memset(prof, 0, sizeof(block_profile_t));
+  b->prof = prof;
+  block_clear(b, line, cfg);
 }
 
 void block_free(block_t *b) {
   assert(b);
-  if (b->line)
+  // the next block can outlive this one (e.g. in streaming programs)
+  if (b->next && b->next->prev == b)
+    b->next->prev = NULL;
+  if (b->arena) // released all at once with the arena
+    return;
+  if (b->line && b->own_line)
     free(b->line);
   if (b->prof)
     free(b->prof);
-  point_free(b->target);
-  point_free(b->center);
-  point_free(b->delta);
   free(b);
   b = NULL;
 }
 
 void block_print(block_t *b, FILE *out) {
   assert(b && out);
-  char *start, *end;
+  char start[32], end[32];
   // if this is the first block, p0 is the origin
   // otherwise is the target of the previous block
-  point_t *p0 = point_zero(b);
+  point_t p0 = point_zero(b);
   // inspect origin and target points
-  point_inspect(p0, &start);
-  point_inspect(b->target, &end);
+  point_format(&p0, start, sizeof(start));
+  point_format(&b->target, end, sizeof(end));
   // print out block description
   fprintf(out, "%03lu %s->%s F%7.1f S%7.1f T%2lu (G%02d)\n", b->n, start, end, b->feedrate, b->spindle, b->tool, b->type);
-  free(end);
-  free(start);
 }
 
 
@@ -135,33 +197,62 @@ void block_print(block_t *b, FILE *out) {
 // Parsing the G-code string. Returns an integer for success/failure
 int block_parse(block_t *b) {
   assert(b);
-  char *word, *line, *tofree;
-  point_t *p0;
+  int rv = block_scan(b);
+  block_inherit(b, b->prev);
+  rv += block_plan(b);
+  // return number of parsing errors
+  return rv;
+}
+
+// Tokenize the G-code string into the block fields
+int block_scan(block_t *b) {
+  assert(b);
+  const char *cursor = b->line;
+  word_t word;
+  word_status_t status;
   int rv = 0;
 
-  tofree = line = strdup(b->line);
-  if (!line) {
-    perror("Could not allocate momory for tokenizing line");
-    return 1;
-  }
-  // Tokenizing loop
-  while ((word = strsep(&line, " ")) != NULL) {
-    // word[0] is the command
-    // word+1 is the pointer to the argument as a string
-    rv += block_set_fields(b, toupper(word[0]), word + 1);
+  b->set = 0;
+  // Tokenizing loop: the lexer scans the line in place, in a single pass
+  while ((status = lexer_next(&cursor, &word)) != WORD_END) {
+    if (status == WORD_ERROR) {
+      fprintf(stderr, "ERROR: Malformed argument for G-code command %c\n",
+              word.cmd);
+      rv++;
+      continue;
+    }
+    rv += block_set_fields(b, word.cmd, word.arg);
   }
-  free(tofree);
+  return rv;
+}
 
-  // inherit modal fields from the previous block
+// Link to the previous block and inherit the modal fields not given in the
+// G-code string
+void block_inherit(block_t *b, block_t *prev) {
+  assert(b);
+  point_t p0;
+  if (prev) {
+    b->prev = prev;
+    prev->next = b;
+    if (!(b->set & N_SET)) b->n = prev->n;
+    if (!(b->set & F_SET)) b->feedrate = prev->feedrate;
+    if (!(b->set & S_SET)) b->spindle = prev->spindle;
+    if (!(b->set & T_SET)) b->tool = prev->tool;
+  }
   p0 = point_zero(b);
-  point_modal(p0, b->target);
-  point_delta(p0, b->target, b->delta);
-  b->length = point_dist(p0, b->target);
-  
-  // deal with motion blocks
+  b->target = point_modal_v(p0, b->target);
+  b->delta = point_delta_v(p0, b->target);
+  b->length = point_dist_v(p0, b->target);
+}
+
+// Calculate geometry and velocity profile of motion blocks
+int block_plan(block_t *b) {
+  assert(b);
+  int rv = 0;
   switch (b->type) {
   case LINE:
     // calculate feed profile
+    b->feed = b->feedrate;
     b->acc = machine_A(b->machine);
     block_compute(b);
     break;
@@ -175,19 +266,22 @@ int block_parse(block_t *b) {
     // set corrected feedrate and acceleration
     // centripetal acc = f^2/r, must be <= A
     // INI file gives A in mm/s^2, feedrate is given in mm/min
-    b->feedrate =
-        MIN(b->feedrate, sqrt(machine_A(b->machine) * b->r) * 60);
+    // the programmed feedrate is left untouched, for it is modal
+    // when limiting the feedrate, only A/sqrt(2) goes to the centripetal
+    // acc, so that A/sqrt(2) is left for the tangential one (otherwise the
+    // block could not accelerate at all)
+    b->feed = MIN(b->feedrate,
+                  sqrt(machine_A(b->machine) * b->r / M_SQRT2) * 60);
     // tangential acceleration: when composed with centripetal one, total
     // acceleration must be <= A
     // a^2 <= A^2 - v^4/r^2
-    b->acc = sqrt(pow(machine_A(b->machine), 2) - pow(b->feedrate / 60, 4) / pow(b->r, 2));
+    b->acc = sqrt(pow(machine_A(b->machine), 2) - pow(b->feed / 60, 4) / pow(b->r, 2));
     // calculate feed profile
     block_compute(b);
     break;
   default:
     break;
   }
-  // return number of parsing errors
   return rv;
 }
 
@@ -195,67 +289,372 @@ int block_parse(block_t *b) {
 // Evaluate the value of lambda at a certaint time
 data_t block_lambda(const block_t *b, data_t t, data_t *v) {
   assert(b);
+  return block_profile_lambda(b->prof, t, v);
+}
+
+// Same as block_lambda, on a bare velocity profile
+data_t block_profile_lambda(const block_profile_t *prof, data_t t, data_t *v) {
+  assert(prof && v);
   data_t r;
-  data_t dt_1 = b->prof->dt_1;
-  data_t dt_2 = b->prof->dt_2;
-  data_t dt_m = b->prof->dt_m;
-  data_t a = b->prof->a;
-  data_t d = b->prof->d;
-  data_t f = b->prof->f;
-
-  if (t < 0) {
+  data_t dt_1 = prof->dt_1;
+  data_t dt_2 = prof->dt_2;
+  data_t dt_m = prof->dt_m;
+  data_t a = prof->a;
+  data_t d = prof->d;
+  data_t f = prof->f;
+  data_t vi = prof->vi;
+
+  if (prof->dt_j1 > 0 || prof->dt_j2 > 0) { // S-curve
+    if (t < 0) {
+      r = 0.0;
+      *v = 0.0;
+    }
+    else if (t < dt_1) {
+      r = ramp_eval(vi, a, prof->dt_j1, dt_1, t, v);
+    }
+    else if (t < (dt_1 + dt_m)) {
+      r = (vi + f) / 2.0 * dt_1 + f * (t - dt_1);
+      *v = f;
+    }
+    else if (t < (dt_1 + dt_m + dt_2)) {
+      r = (vi + f) / 2.0 * dt_1 + f * dt_m +
+          ramp_eval(f, d, prof->dt_j2, dt_2, t - dt_1 - dt_m, v);
+    }
+    else {
+      r = prof->l;
+      *v = prof->vf;
+    }
+  }
+  else if (t < 0) {
     r = 0.0;
     *v = 0.0;
   }
   else if (t < dt_1) { // acceleration
-    r = a * pow(t, 2) / 2.0;
-    *v = a * t;
+    r = vi * t + a * t * t / 2.0;
+    *v = vi + a * t;
   }
   else if (t < (dt_1 + dt_m)) { // maintenance
-    r = f * (dt_1 / 2.0 + (t - dt_1));
+    r = f * (dt_1 / 2.0 + (t - dt_1)) + vi * dt_1 / 2.0;
     *v = f;
   }
   else if (t < (dt_1 + dt_m + dt_2)) { // deceleration
     data_t t_2 = dt_1 + dt_m;
     r = f * dt_1 / 2.0 + f * (dt_m + t - t_2) +
-      d / 2.0 * (pow(t, 2) + pow(t_2, 2)) - d * t * t_2;
+      d / 2.0 * (t * t + t_2 * t_2) - d * t * t_2 + vi * dt_1 / 2.0;
     *v = f + d * (t - dt_1 - dt_m);
   }
   else {
-    r = b->prof->l;
-    *v = 0;
+    r = prof->l;
+    *v = prof->vf;
   }
-  r /= b->prof->l;
+  r /= prof->l;
   *v *= 60; // convert to mm/min
   return r;
 }
 
-// CAREFUL: this function allocates a point
-point_t *block_interpolate(block_t *b, data_t lambda) {
+// Start sampling b at time t0 (in [0, tq) for the first sample of a block)
+void block_sampler_init(block_sampler_t *s, const block_t *b, data_t t0) {
+  assert(s && b);
+  const block_profile_t *prof = b->prof;
+  s->prof = prof;
+  s->tq = machine_tq(b->machine);
+  s->t = t0;
+  data_t a = prof->a, d = prof->d;
+  data_t j1 = prof->dt_j1 > 0 ? a / prof->dt_j1 : 0;
+  data_t j2 = prof->dt_j2 > 0 ? d / prof->dt_j2 : 0;
+  // phases of a trapezoid are the same, with no jerk phases
+  s->t_end[0] = prof->dt_j1;
+  s->t_end[1] = prof->dt_1 - prof->dt_j1;
+  s->t_end[2] = prof->dt_1;
+  s->t_end[3] = prof->dt_1 + prof->dt_m;
+  s->t_end[4] = s->t_end[3] + prof->dt_j2;
+  s->t_end[5] = prof->dt_1 + prof->dt_m + prof->dt_2 - prof->dt_j2;
+  s->t_end[6] = prof->dt_1 + prof->dt_m + prof->dt_2;
+  s->acc[0] = 0;  s->jerk[0] = j1;
+  s->acc[1] = a;  s->jerk[1] = 0;
+  s->acc[2] = a;  s->jerk[2] = -j1;
+  s->acc[3] = 0;  s->jerk[3] = 0;
+  s->acc[4] = 0;  s->jerk[4] = j2;
+  s->acc[5] = d;  s->jerk[5] = 0;
+  s->acc[6] = d;  s->jerk[6] = -j2;
+  s->inv_l = 1.0 / prof->l;
+  s->phase = -1;
+  block_sampler_phase(s);
+}
+
+// Lambda and speed (mm/min) at the current time, then step by tq
+data_t block_sampler_next(block_sampler_t *s, data_t *v) {
+  assert(s && v);
+  data_t r = s->lambda;
+  *v = s->v * 60;
+  s->t += s->tq;
+  if (s->phase < 7 && s->t >= s->t_end[s->phase]) {
+    block_sampler_phase(s);
+  }
+  else {
+    s->lambda += s->dl;
+    s->dl += s->ddl;
+    s->ddl += s->dddl;
+    s->v += s->dv;
+    s->dv += s->ddv;
+  }
+  return r;
+}
+
+// Maximum speed at the junction between b->prev and b
+data_t block_junction(const block_t *b) {
   assert(b);
-  point_t *result = point_new();
-  point_t *p0 = point_zero(b);
+  const block_t *a = b->prev;
+  data_t u0[3], u1[3], cos_t, sin_t2, v;
+  // (negated comparisons also catch NaN lengths of broken blocks)
+  if (!a || !block_is_feed(a) || !block_is_feed(b) || !(a->length > 0) ||
+      !(b->length > 0))
+    return 0;
+  v = MIN(a->feed, b->feed) / 60.0;
+  // directions at the end of a and at the start of b
+  block_direction(a, 1, u0);
+  block_direction(b, 0, u1);
+  // theta is the angle between the two blocks at the corner: PI means no
+  // corner at all, 0 means going back along the same path
+  cos_t = -(u0[0] * u1[0] + u0[1] * u1[1] + u0[2] * u1[2]);
+  if (isnan(cos_t))
+    return 0;
+  if (cos_t < -0.999999)
+    return v;
+  if (cos_t > 0.999999)
+    return 0;
+  // radius of the arc tangent to both blocks at distance error from the
+  // corner: R = error * sin(theta/2) / (1 - sin(theta/2))
+  // centripetal acc v^2/R must be <= A
+  sin_t2 = sqrt((1 - cos_t) / 2.0);
+  return MIN(v, sqrt(machine_A(b->machine) * machine_error(b->machine) *
+                     sin_t2 / (1 - sin_t2)));
+}
+
+// Highest speed reachable from v0 within the block length
+data_t block_reachable(const block_t *b, data_t v0) {
+  assert(b);
+  data_t A = b->acc, J = machine_J(b->machine), l = b->length;
+  // with no jerk limit (or a broken block, giving NaN)
+  data_t lo = v0, hi = sqrt(v0 * v0 + 2 * A * l), v;
+  if (!(J > 0) || !(hi > lo))
+    return hi;
+  // the S-curve is slower: bisection between v0 and the trapezoid speed
+  for (int k = 0; k < 64 && hi - lo > 1e-12 * hi; k++) {
+    v = (lo + hi) / 2.0;
+    if (ramp_length(v0, v, A, J) > l)
+      hi = v;
+    else
+      lo = v;
+  }
+  return lo;
+}
+
+// Re-plan the velocity profile with the given boundary speeds
+void block_set_speeds(block_t *b, data_t vi, data_t vf) {
+  assert(b && b->prof);
+  if (!block_is_feed(b))
+    return;
+  b->prof->vi = vi;
+  b->prof->vf = vf;
+  block_compute(b);
+}
+
+// Merge the following collinear blocks into b
+size_t block_merge(block_t *b, data_t tol, size_t max) {
+  assert(b);
+  block_t *c, *d, *end = NULL;
+  point_t p0;
+  data_t u, u_prev;
+  size_t n = 0, k;
+  if (b->type != LINE)
+    return 0;
+  p0 = point_zero(b);
+  // grow the run one block at a time, checking the end points of all the
+  // blocks in it against the new chord: they must be within tol, and their
+  // projections must not go backwards (the path cannot be reversed)
+  for (c = b->next, k = 1; c && k <= max; c = c->next, k++) {
+    if (c->type != LINE || c->feedrate != b->feedrate ||
+        c->spindle != b->spindle || c->tool != b->tool)
+      break;
+    u_prev = 0;
+    for (d = b; d != c; d = d->next) {
+      if (segment_distance(p0, c->target, d->target, &u) > tol || u < u_prev)
+        break;
+      u_prev = u;
+    }
+    if (d != c)
+      break;
+    end = c;
+    n = k;
+  }
+  if (!end)
+    return 0;
+  b->next = end->next;
+  if (end->next)
+    end->next->prev = b;
+  b->target = end->target;
+  b->delta = point_delta_v(p0, b->target);
+  b->length = point_dist_v(p0, b->target);
+  block_plan(b);
+  return n;
+}
+
+// Replace b and the following G01 blocks with a single arc
+size_t block_fit_arc(block_t *b, data_t tol, size_t max) {
+  assert(b);
+  block_t *c, *m, *end = NULL;
+  point_t p0, center, best_c;
+  data_t r, span, best_r = 0, best_span = 0, cross;
+  int dir, best_dir = 0;
+  size_t n = 0, k, h;
+  if (b->type != LINE)
+    return 0;
+  p0 = point_zero(b);
+  // grow the run one block at a time: the candidate arc goes through the
+  // start of b, the end of c and the middle vertex, and all the vertices
+  // and segments of the run must be within tol from it. The run stops at
+  // the first failure
+  for (c = b->next, k = 1; c && k <= max; c = c->next, k++) {
+    if (c->type != LINE || c->feedrate != b->feedrate ||
+        c->spindle != b->spindle || c->tool != b->tool)
+      break;
+    if (k + 1 < ARC_MIN_BLOCKS)
+      continue;
+    for (m = b, h = 0; h < k / 2; h++)
+      m = m->next;
+    if (circle_through(p0, m->target, c->target, &center, &r))
+      break;
+    cross = (m->target.x - p0.x) * (c->target.y - m->target.y) -
+            (m->target.y - p0.y) * (c->target.x - m->target.x);
+    dir = cross > 0 ? 1 : -1;
+    if (!(span = arc_fits(b, c, center, r, dir, tol)))
+      break;
+    end = c;
+    n = k;
+    best_c = center;
+    best_r = r;
+    best_span = span;
+    best_dir = dir;
+  }
+  // nearly straight runs are left to block_merge
+  if (!end || best_r * (1 - cos(best_span / 2)) <= tol)
+    return 0;
+  b->next = end->next;
+  if (end->next)
+    end->next->prev = b;
+  b->type = best_dir > 0 ? ARC_CCW : ARC_CW;
+  b->target = end->target;
+  b->delta = point_delta_v(p0, b->target);
+  b->i = best_c.x - p0.x;
+  b->j = best_c.y - p0.y;
+  b->r = 0;
+  block_plan(b);
+  return n;
+}
+
+// Interpolate lambda over three axes, with no allocations: non-motion
+// blocks stay at their starting point
+point_t block_interpolate_v(const block_t *b, data_t lambda) {
+  assert(b);
+  point_t p0 = point_zero(b);
+  point_t result;
 
   if (b->type == LINE) {
-    point_set_x(result, point_x(p0) + point_x(b->delta) * lambda);
-    point_set_y(result, point_y(p0) + point_y(b->delta) * lambda);
+    result.x = p0.x + b->delta.x * lambda;
+    result.y = p0.y + b->delta.y * lambda;
   }
   else if (b->type == ARC_CW || b->type == ARC_CCW) {
-    point_set_x(result, point_x(b->center) + 
-      b->r * cos(b->theta0 + b->dtheta * lambda));
-    point_set_y(result, point_y(b->center) + 
-      b->r * sin(b->theta0 + b->dtheta * lambda));
+    result.x = b->center.x + b->r * cos(b->theta0 + b->dtheta * lambda);
+    result.y = b->center.y + b->r * sin(b->theta0 + b->dtheta * lambda);
   }
   else {
+    return p0;
+  }
+  result.z = p0.z + b->delta.z * lambda;
+  result.s = ALL_SET;
+  return result;
+}
+
+// CAREFUL: this function allocates a point
+point_t *block_interpolate(block_t *b, data_t lambda) {
+  assert(b);
+  if (b->type != LINE && b->type != ARC_CW && b->type != ARC_CCW) {
     fprintf(stderr, "Unexpected block type!\n");
     return NULL;
   }
-  point_set_z(result, point_z(p0) + point_z(b->delta) * lambda);
-
+  point_t *result = point_new();
+  *result = block_interpolate_v(b, lambda);
   return result;
 }
 
 
+// BATCH SAMPLING ==============================================================
+
+// Number of samples at t0 + k*tq <= dt
+size_t block_samples(const block_t *b, data_t t0) {
+  assert(b);
+  data_t dt = b->prof->dt;
+  if (!block_is_feed(b) || t0 > dt)
+    return 0;
+  return (size_t)((dt - t0) / machine_tq(b->machine)) + 1;
+}
+
+// Time of the first sample of the next block
+data_t block_carry(const block_t *b, data_t t0) {
+  assert(b);
+  if (!block_is_feed(b))
+    return t0;
+  return t0 + block_samples(b, t0) * machine_tq(b->machine) - b->prof->dt;
+}
+
+// Render samples [from, from+n) in the caller buffers
+// Lambdas are computed first, a chunk at a time and incrementally, then the
+// positions of the whole chunk are computed at once by the vectorized kernels
+#define RENDER_CHUNK 256
+size_t block_render(const block_t *b, data_t t0, size_t from, size_t n,
+                    const block_trajectory_t *out) {
+  assert(b && out);
+  size_t i, j, k, m, to = MIN(block_samples(b, t0), from + n);
+  data_t tq = machine_tq(b->machine);
+  point_t p0 = point_zero(b);
+  data_t buf[RENDER_CHUNK], *l, v;
+  block_sampler_t s;
+  // the vectorized sin/cos is accurate enough for any reasonable radius, but
+  // fall back to libm rather than exceeding the tolerance
+  int simd = b->r * KERNEL_SINCOS_ERROR < machine_error(b->machine);
+
+  block_sampler_init(&s, b, t0 + from * tq);
+  for (k = from, i = 0; k < to; k += m, i += m) {
+    m = MIN(to - k, RENDER_CHUNK);
+    l = out->lambda ? out->lambda + i : buf;
+    for (j = 0; j < m; j++) {
+      l[j] = block_sampler_next(&s, &v);
+      if (out->t) out->t[i + j] = t0 + (k + j) * tq;
+      if (out->feed) out->feed[i + j] = v;
+    }
+    if (b->type == LINE) {
+      if (out->x) kernel_line(m, l, p0.x, b->delta.x, out->x + i);
+      if (out->y) kernel_line(m, l, p0.y, b->delta.y, out->y + i);
+    }
+    else if (simd) {
+      kernel_arc(m, l, b->center.x, b->center.y, b->r, b->theta0, b->dtheta,
+                 out->x ? out->x + i : NULL, out->y ? out->y + i : NULL);
+    }
+    else {
+      for (j = 0; j < m; j++) {
+        data_t theta = b->theta0 + b->dtheta * l[j];
+        if (out->x) out->x[i + j] = b->center.x + b->r * cos(theta);
+        if (out->y) out->y[i + j] = b->center.y + b->r * sin(theta);
+      }
+    }
+    if (out->z) kernel_line(m, l, p0.z, b->delta.z, out->z + i);
+  }
+  return i;
+}
+#undef RENDER_CHUNK
+
+
 // GETTERS =====================================================================
 
 #define block_getter(typ, par, name) \
@@ -268,8 +667,24 @@ block_getter(block_type_t, type, type);
 block_getter(char *, line, line);
 block_getter(size_t, n, n);
 block_getter(data_t, r, r);
-block_getter(point_t *, center, center);
 block_getter(block_t *, next, next);
+block_getter(block_t *, prev, prev);
+block_getter(data_t, feedrate, feedrate);
+block_getter(data_t, feed, feed);
+block_getter(data_t, spindle, spindle);
+block_getter(size_t, tool, tool);
+block_getter(data_t, theta0, theta0);
+block_getter(data_t, acc, acc);
+block_getter(const block_profile_t *, prof, profile);
+
+// points are embedded in the block: these getters return their address
+#define block_point_getter(name) \
+point_t *block_##name(const block_t *b) { \
+  assert(b); return (point_t *)&b->name; }
+
+block_point_getter(center);
+block_point_getter(target);
+block_point_getter(delta);
 
 
 
@@ -289,34 +704,122 @@ static data_t quantize(data_t t, data_t tq, data_t *dq) {
   return q;
 }
 
+// Distance of p from the segment a-b; u is the position of the projection of
+// p on the segment line (0 at a, 1 at b)
+static data_t segment_distance(point_t a, point_t b, point_t p, data_t *u) {
+  point_t ab = point_delta_v(a, b), ap = point_delta_v(a, p);
+  data_t l2 = ab.x * ab.x + ab.y * ab.y + ab.z * ab.z;
+  *u = l2 > 0 ? (ap.x * ab.x + ap.y * ab.y + ap.z * ab.z) / l2 : 0;
+  if (*u <= 0)
+    return point_dist_v(a, p);
+  if (*u >= 1)
+    return point_dist_v(b, p);
+  return point_dist_v(point_v(a.x + ab.x * *u, a.y + ab.y * *u,
+                              a.z + ab.z * *u), p);
+}
+
+// Center and radius of the circle through a, m and c, on the XY plane.
+// Returns 1 if the points are (almost) aligned
+static int circle_through(point_t a, point_t m, point_t c, point_t *center,
+                          data_t *r) {
+  // relative to a, for precision
+  data_t bx = m.x - a.x, by = m.y - a.y, cx = c.x - a.x, cy = c.y - a.y;
+  data_t d = 2 * (bx * cy - by * cx), b2 = bx * bx + by * by;
+  data_t c2 = cx * cx + cy * cy, ux, uy;
+  if (!(fabs(d) > 1e-12 * (b2 + c2)))
+    return 1;
+  ux = (cy * b2 - by * c2) / d;
+  uy = (bx * c2 - cx * b2) / d;
+  *center = point_v(a.x + ux, a.y + uy, 0);
+  *r = hypot(ux, uy);
+  return 0;
+}
+
+// Angle spanned by the arc of center and radius r, traveled CCW if dir > 0,
+// CW otherwise, from the start of b to the end of c; 0 unless the polyline
+// between them is within tol from the arc: every segment must be within tol
+// from the circle (on the XY plane, the distance from the center is largest
+// at its ends and smallest at the point nearest to the center), with its
+// vertices in order along the arc; z must grow linearly with the angle, as
+// in a helix
+static data_t arc_fits(const block_t *b, const block_t *c, point_t center,
+                       data_t r, int dir, data_t tol) {
+  point_t p0 = point_zero(b), q, s = p0;
+  data_t theta0 = atan2(p0.y - center.y, p0.x - center.x);
+  data_t total, phi, phi_prev = 0, dx, dy, l2, u;
+  const block_t *d;
+  q = c->target;
+  total = dir * (atan2(q.y - center.y, q.x - center.x) - theta0);
+  total = fmod(total + 4 * M_PI, 2 * M_PI);
+  if (!(total > 0))
+    return 0;
+  for (d = b;; d = d->next) {
+    q = d->target;
+    phi = dir * (atan2(q.y - center.y, q.x - center.x) - theta0);
+    phi = d == c ? total : fmod(phi + 4 * M_PI, 2 * M_PI);
+    dx = q.x - s.x;
+    dy = q.y - s.y;
+    l2 = dx * dx + dy * dy;
+    u = l2 > 0 ? ((center.x - s.x) * dx + (center.y - s.y) * dy) / l2 : 0;
+    u = MIN(MAX(u, 0), 1);
+    if (fabs(hypot(q.x - center.x, q.y - center.y) - r) > tol ||
+        r - hypot(s.x + u * dx - center.x, s.y + u * dy - center.y) > tol ||
+        phi <= phi_prev || phi > total || phi - phi_prev >= M_PI ||
+        fabs(q.z - p0.z - (c->target.z - p0.z) * phi / total) > tol)
+      return 0;
+    phi_prev = phi;
+    s = q;
+    if (d == c)
+      break;
+  }
+  return total;
+}
+
 // Calcultare the velocity profile
 static void block_compute(block_t *b) {
   assert(b);
   data_t A, a, d;
   data_t dt, dt_1, dt_2, dt_m, dq;
   data_t f_m, l;
+  // boundary speeds (0 unless set by block_set_speeds)
+  data_t vi = b->prof->vi, vf = b->prof->vf;
 
+  if (machine_J(b->machine) > 0) {
+    block_compute_s(b);
+    return;
+  }
   A = b->acc;
-  f_m = b->feedrate / 60.0;
+  f_m = b->feed / 60.0;
   l = b->length;
-  dt_1 = f_m / A;
-  dt_2 = dt_1;
-  dt_m = l /f_m - (dt_1 + dt_2) / 2.0;
+  dt_1 = (f_m - vi) / A;
+  dt_2 = (f_m - vf) / A;
+  dt_m = l / f_m - (dt_1 + dt_2) / 2.0 - (vi * dt_1 + vf * dt_2) / (2 * f_m);
   if (dt_m > 0) { // trapezoidal profile
-    dt = quantize(dt_1 + dt_m + dt_2, machine_tq(b->machine), &dq);
-    dt_m += dq; 
-    f_m = (2 * l) / (dt_1 + dt_2 + 2 * dt_m);
-  }
-  else { // triangular profile (short block)
-    dt_1 = sqrt(l / A);
-    dt_2 = dt_1;
-    dt = quantize(dt_1 + dt_2, machine_tq(b->machine), &dq);
+    dt = dt_1 + dt_m + dt_2;
+  }
+  else { // triangular profile (short block): peak speed reached at the end
+    // of acceleration is sqrt(A*l + (vi^2 + vf^2)/2)
+    f_m = sqrt(A * l + (vi * vi + vf * vf) / 2.0);
+    dt_1 = MAX((f_m - vi) / A, 0);
+    dt_2 = MAX((f_m - vf) / A, 0);
+    dt = dt_1 + dt_2;
     dt_m = 0;
-    dt_2 += dq;
-    f_m = 2 * l / (dt_1 + dt_2);
   }
-  a = f_m / dt_1;
-  d = -(f_m / dt_2);
+  // blocks starting and ending at rest last a multiple of the sampling time
+  // (the time is rounded up, lowering the peak speed so that the length is
+  // unchanged). Blocks joined at non-zero speed are not rounded, for it
+  // would break the speed continuity: the time left over at their end has
+  // to be carried on to the next block
+  if (vi == 0 && vf == 0) {
+    dt = quantize(dt, machine_tq(b->machine), &dq);
+    if (dt_m > 0)
+      dt_m += dq;
+    else
+      dt_2 += dq;
+  }
+  f_m = (2 * l - vi * dt_1 - vf * dt_2) / (dt_1 + dt_2 + 2 * dt_m);
+  a = dt_1 > 0 ? (f_m - vi) / dt_1 : 0;
+  d = dt_2 > 0 ? (vf - f_m) / dt_2 : 0;
   // set calculated values in block object
   b->prof->dt_1 = dt_1;
   b->prof->dt_2 = dt_2;
@@ -326,22 +829,120 @@ static void block_compute(block_t *b) {
   b->prof->f = f_m;
   b->prof->dt = dt;
   b->prof->l = l;
+  b->prof->dt_j1 = b->prof->dt_j2 = 0;
+}
+
+// Calculate the jerk-limited velocity profile: as in block_compute, but each
+// speed change is an S-curve ramp (see ramp_time)
+static void block_compute_s(block_t *b) {
+  data_t A = b->acc, J = machine_J(b->machine);
+  data_t vi = b->prof->vi, vf = b->prof->vf;
+  data_t f_m = b->feed / 60.0, l = b->length;
+  data_t dt, dt_1, dt_2, dt_m, dt_j1, dt_j2, dq, lo, hi;
+
+  dt_1 = ramp_time(f_m - vi, A, J, &dt_j1);
+  dt_2 = ramp_time(f_m - vf, A, J, &dt_j2);
+  dt_m = (l - ramp_length(vi, f_m, A, J) - ramp_length(f_m, vf, A, J)) / f_m;
+  if (!(dt_m > 0)) { // short block: the peak speed is found by bisection
+    lo = MAX(vi, vf);
+    hi = f_m;
+    for (int k = 0; k < 64 && hi - lo > 1e-12 * hi; k++) {
+      f_m = (lo + hi) / 2.0;
+      if (ramp_length(vi, f_m, A, J) + ramp_length(f_m, vf, A, J) > l)
+        hi = f_m;
+      else
+        lo = f_m;
+    }
+    f_m = lo;
+    dt_1 = ramp_time(f_m - vi, A, J, &dt_j1);
+    dt_2 = ramp_time(f_m - vf, A, J, &dt_j2);
+    dt_m = 0;
+  }
+  dt = dt_1 + dt_m + dt_2;
+  // blocks at rest last a multiple of the sampling time, as in
+  // block_compute: the time is added to the maintenance phase (possibly
+  // creating it), and ramps keep their times and lower their acceleration
+  if (vi == 0 && vf == 0) {
+    dt = quantize(dt, machine_tq(b->machine), &dq);
+    dt_m += dq;
+  }
+  // ramps are symmetric, so that the length is the same as a trapezoid's
+  f_m = (2 * l - vi * dt_1 - vf * dt_2) / (dt_1 + dt_2 + 2 * dt_m);
+  b->prof->dt_1 = dt_1;
+  b->prof->dt_2 = dt_2;
+  b->prof->dt_m = dt_m;
+  b->prof->dt_j1 = dt_j1;
+  b->prof->dt_j2 = dt_j2;
+  b->prof->a = dt_1 > 0 ? (f_m - vi) / (dt_1 - dt_j1) : 0;
+  b->prof->d = dt_2 > 0 ? (vf - f_m) / (dt_2 - dt_j2) : 0;
+  b->prof->f = f_m;
+  b->prof->dt = dt;
+  b->prof->l = l;
+}
+
+// Time of an S-curve ramp changing speed by dv, with max acceleration A and
+// max jerk J; tj is the time of its two jerk phases. If dv is too small to
+// reach A, the ramp has no constant acceleration phase
+static data_t ramp_time(data_t dv, data_t A, data_t J, data_t *tj) {
+  if (!(dv > 0)) {
+    *tj = 0;
+    return 0;
+  }
+  if (dv >= A * A / J) {
+    *tj = A / J;
+    return dv / A + *tj;
+  }
+  *tj = sqrt(dv / J);
+  return 2 * *tj;
+}
+
+// Length of an S-curve ramp between speeds v0 and v1 (its mean speed is
+// (v0 + v1) / 2, by symmetry)
+static data_t ramp_length(data_t v0, data_t v1, data_t A, data_t J) {
+  data_t tj;
+  return (v0 + v1) / 2.0 * ramp_time(fabs(v1 - v0), A, J, &tj);
+}
+
+// Length and speed v at time t along an S-curve ramp starting at speed v0,
+// lasting T, with jerk phases of tj and peak acceleration a (negative when
+// slowing down)
+static data_t ramp_eval(data_t v0, data_t a, data_t tj, data_t T, data_t t,
+                        data_t *v) {
+  data_t j = tj > 0 ? a / tj : 0, tc = T - 2 * tj;
+  data_t v1, s1, v2, s2;
+  if (t < tj) { // rising acceleration
+    *v = v0 + j * t * t / 2.0;
+    return v0 * t + j * t * t * t / 6.0;
+  }
+  v1 = v0 + a * tj / 2.0;
+  s1 = v0 * tj + a * tj * tj / 6.0;
+  t -= tj;
+  if (t < tc) { // constant acceleration
+    *v = v1 + a * t;
+    return s1 + v1 * t + a * t * t / 2.0;
+  }
+  // falling acceleration
+  v2 = v1 + a * tc;
+  s2 = s1 + v1 * tc + a * tc * tc / 2.0;
+  t -= tc;
+  *v = v2 + a * t - j * t * t / 2.0;
+  return s2 + v2 * t + a * t * t / 2.0 - j * t * t * t / 6.0;
 }
 
 // Calculate the arc coordinates
 static int block_arc(block_t *b) {
   data_t x0, y0, z0, xc, yc, xf, yf, zf, r;
-  point_t *p0 = point_zero(b);
-  x0 = point_x(p0);
-  y0 = point_y(p0);
-  z0 = point_z(p0);
-  xf = point_x(b->target);
-  yf = point_y(b->target);
-  zf = point_z(b->target);
+  point_t p0 = point_zero(b);
+  x0 = p0.x;
+  y0 = p0.y;
+  z0 = p0.z;
+  xf = b->target.x;
+  yf = b->target.y;
+  zf = b->target.z;
 
   if (b->r) { // if the radius is given
-    data_t dx = point_x(b->delta);
-    data_t dy = point_y(b->delta);
+    data_t dx = b->delta.x;
+    data_t dy = b->delta.y;
     r = b->r;
     data_t dxy2 = pow(dx, 2) + pow(dy, 2);
     data_t sq = sqrt(-pow(dy, 2) * dxy2 * (dxy2 - 4 * r * r));
@@ -367,8 +968,8 @@ static int block_arc(block_t *b) {
     }
     b->r = r;
   }
-  point_set_x(b->center, xc);
-  point_set_y(b->center, yc);
+  b->center = point_with_x(b->center, xc);
+  b->center = point_with_y(b->center, yc);
   b->theta0 = atan2(y0 - yc, x0 - xc);
   b->dtheta = atan2(yf - yc, xf - xc) - b->theta0;
   // we need the net angle so we take the 2PI complement if negative
@@ -384,53 +985,156 @@ static int block_arc(block_t *b) {
   return 0;
 }
 
+// Allocate a block and inherit the modal state from prev; line is taken as
+// is. If arena is not NULL, all the memory comes from there
+static block_t *block_init(char *line, block_t *prev, machine_t *cfg,
+                           arena_t *arena) {
+  block_t *b;
+  if (arena)
+    b = (block_t *)arena_alloc(arena, sizeof(block_t));
+  else
+    b = (block_t *)calloc(1, sizeof(block_t));
+  if (!b) {
+    perror("Could not allocate block");
+    return NULL;
+  }
+
+  if (prev) { // copy the memory from the previous block
+    memcpy(b, prev, sizeof(block_t));
+    b->prev = prev;
+    prev->next = b;
+  } else { // this is the first block
+    // nothing to do
+  }
+
+  b->arena = arena;
+  // allocate profile struct
+  if (arena)
+    b->prof = (block_profile_t *)arena_alloc(arena, sizeof(block_profile_t));
+  else
+    b->prof = (block_profile_t *)calloc(1, sizeof(block_profile_t));
+  if (!b->prof) {
+    perror("Could not allocate profile structure");
+    return NULL;
+  }
+  block_clear(b, line, cfg);
+  return b;
+}
+
+// Reset the non-modal and the calculated fields of a new block
+static void block_clear(block_t *b, char *line, machine_t *cfg) {
+  // non-modal g-code parameters: I, J, R
+  b->i = b->j = b->r = 0.0;
+
+  // fields to be calculated
+  b->length = 0.0;
+  b->target = b->delta = b->center = point_none();
+  b->machine = cfg;
+  b->type = NO_MOTION;
+  b->acc = machine_A(b->machine);
+  b->line = line;
+  b->own_line = 0;
+}
+
+// True for the blocks that are planned (feed motions)
+static int block_is_feed(const block_t *b) {
+  return b->type == LINE || b->type == ARC_CW || b->type == ARC_CCW;
+}
+
+// Move the sampler to the phase containing its current time: lambda and
+// speed are evaluated exactly, so rounding errors do not pile up across
+// phases, then the forward differences are set up for that phase (lambda is
+// a cubic of time in jerk phases, a quadratic otherwise)
+static void block_sampler_phase(block_sampler_t *s) {
+  data_t acc, jerk, h = s->tq, h2 = h * h, h3 = h2 * h;
+  if (s->phase < 0)
+    s->phase = 0;
+  while (s->phase < 7 && s->t >= s->t_end[s->phase])
+    s->phase++;
+  s->lambda = block_profile_lambda(s->prof, s->t, &s->v);
+  s->v /= 60;
+  if (s->phase == 7) { // stopped at the end
+    s->dl = s->ddl = s->dddl = s->dv = s->ddv = 0;
+    return;
+  }
+  jerk = s->jerk[s->phase];
+  acc = s->acc[s->phase] +
+        jerk * (s->t - (s->phase ? s->t_end[s->phase - 1] : 0));
+  s->dl = (s->v * h + acc * h2 / 2.0 + jerk * h3 / 6.0) * s->inv_l;
+  s->ddl = (acc * h2 + jerk * h3) * s->inv_l;
+  s->dddl = jerk * h3 * s->inv_l;
+  s->dv = acc * h + jerk * h2 / 2.0;
+  s->ddv = jerk * h2;
+}
+
+// Unit vector tangent to the path at lambda, in the motion direction
+static void block_direction(const block_t *b, data_t lambda, data_t u[3]) {
+  if (b->type == LINE) {
+    u[0] = b->delta.x / b->length;
+    u[1] = b->delta.y / b->length;
+    u[2] = b->delta.z / b->length;
+  }
+  else { // arc: derivative of block_interpolate w.r.t. lambda
+    data_t theta = b->theta0 + b->dtheta * lambda;
+    u[0] = -b->r * b->dtheta * sin(theta) / b->length;
+    u[1] = b->r * b->dtheta * cos(theta) / b->length;
+    u[2] = b->delta.z / b->length;
+  }
+}
+
 // Return a reliable previous point, i.e. machine zero if this is the first 
 // block
-static point_t *point_zero(block_t *b) {
+static point_t point_zero(const block_t *b) {
   assert(b);
-  return b->prev ? b->prev->target : machine_zero(b->machine);
+  return b->prev ? b->prev->target : *machine_zero(b->machine);
 }
 
 // Parse a single G-code word (cmd+arg)
-static int block_set_fields(block_t *b, char cmd, char *arg) {
-  assert(b && arg);
+static int block_set_fields(block_t *b, char cmd, data_t arg) {
+  assert(b);
   switch (cmd)
   {
   case 'N':
-    b->n = atol(arg);
+    if (word_index(cmd, arg, &b->n))
+      return 1;
+    b->set |= N_SET;
     break;
   case 'G':
-    b->type = (block_type_t)atoi(arg);
+    b->type = (block_type_t)arg;
     break;
   case 'X':
-    point_set_x(b->target, atof(arg));
+    b->target = point_with_x(b->target, arg);
     break;
   case 'Y':
-    point_set_y(b->target, atof(arg));
+    b->target = point_with_y(b->target, arg);
     break;
   case 'Z':
-    point_set_z(b->target, atof(arg));
+    b->target = point_with_z(b->target, arg);
     break;
   case 'I': 
-    b->i = atof(arg);
+    b->i = arg;
     break;
   case 'J':
-    b->j = atof(arg);
+    b->j = arg;
     break;
   case 'R':
-    b->r = atof(arg);
+    b->r = arg;
     break;
   case 'F':
-    b->feedrate = atof(arg);
+    b->feedrate = arg;
+    b->set |= F_SET;
     break;
   case 'S':
-    b->spindle = atof(arg);
+    b->spindle = arg;
+    b->set |= S_SET;
     break; 
   case 'T':
-    b->tool = atol(arg);   
+    if (word_index(cmd, arg, &b->tool))
+      return 1;
+    b->set |= T_SET;
     break;
   default:
-    fprintf(stderr, "ERROR: Usupported G-code command %c%s\n", cmd, arg);
+    fprintf(stderr, "ERROR: Usupported G-code command %c%g\n", cmd, arg);
     return 1;
     break;
   }
@@ -442,6 +1146,17 @@ static int block_set_fields(block_t *b, char cmd, char *arg) {
   return 0;
 }
 
+// Argument of a counting word (N, T): a non-negative integer, small enough
+// to be converted to size_t on any platform (casting anything else is UB)
+static int word_index(char cmd, data_t arg, size_t *val) {
+  if (!(arg >= 0 && arg <= UINT32_MAX) || arg != floor(arg)) {
+    fprintf(stderr, "ERROR: Invalid %c%g, must be an integer >= 0\n", cmd, arg);
+    return 1;
+  }
+  *val = (size_t)arg;
+  return 0;
+}
+
 
 
 
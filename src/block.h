@@ -11,6 +11,7 @@
 #include "defines.h"
 #include "point.h"
 #include "machine.h"
+#include "arena.h"
 
 //   _____                      
 //  |_   _|   _ _ __   ___  ___ 
@@ -22,6 +23,50 @@
 // Opaque structure representing a G-code block
 typedef struct block block_t;
 
+// Compiled program (see compiled.h)
+struct compiled;
+
+// Velocity profile
+// Speeds are in mm/s; the block starts at speed vi and ends at speed vf,
+// which are 0 unless a look-ahead planner has joined it to its neighbors.
+// dt is a multiple of the sampling time only if the block starts and ends
+// at rest.
+// The profile is a trapezoid (acceleration, maintenance and deceleration)
+// unless the machine has a max jerk (see machine_J): then acceleration and
+// deceleration are S-curves, each made of a jerk phase of dt_j, a constant
+// acceleration phase and a jerk phase of dt_j again (7 phases in total),
+// with a and d their peak accelerations
+typedef struct {
+  data_t a, d;             // acceleration
+  data_t f, l;             // feedrate and length
+  data_t dt_1, dt_m, dt_2; // trapezoid times
+  data_t dt;               // total time
+  data_t vi, vf;           // entry and exit speeds
+  data_t dt_j1, dt_j2;     // jerk phase times (0 for trapezoids)
+} block_profile_t;
+
+// Caller-owned buffers for block_render: any of them can be NULL
+typedef struct {
+  data_t *t;         // time from the start of the block
+  data_t *lambda;    // curvilinear abscissa (0 to 1)
+  data_t *feed;      // actual feedrate (mm/min)
+  data_t *x, *y, *z; // position
+} block_trajectory_t;
+
+// Incremental sampler of a velocity profile at fixed sampling time (see
+// block_sampler_init); the fields are private
+typedef struct {
+  const block_profile_t *prof;
+  data_t tq, t;            // sampling time and time of the next sample
+  data_t lambda, v;        // lambda and speed (mm/s) at time t
+  data_t dl, ddl, dddl;    // forward differences of lambda
+  data_t dv, ddv;          // forward differences of speed
+  int phase;               // 0 to 6 (see block_profile_t), 7: done
+  data_t t_end[7];         // end times of the phases
+  data_t acc[7], jerk[7];  // acceleration at start and jerk of each phase
+  data_t inv_l;            // 1 / length
+} block_sampler_t;
+
 // Block types
 typedef enum {
   RAPID = 0,
@@ -41,6 +86,20 @@ typedef enum {
 // LIFECYCLE ===================================================================
 
 block_t *block_new(const char *line, block_t *prev, machine_t *cfg);
+// Same as block_new, but the block refers to line rather than copying it:
+// line must outlive the block (e.g. a slice of a memory-mapped file)
+block_t *block_new_ref(char *line, block_t *prev, machine_t *cfg);
+// Same as block_new_ref, but all the block memory is allocated in an arena:
+// block_free does nothing on such blocks, they are released with the arena
+block_t *block_new_in(arena_t *a, char *line, block_t *prev, machine_t *cfg);
+// Same as block_new_in, but the block is already parsed: all the fields are
+// restored from block i of a compiled program (see compiled.h)
+block_t *block_restore(const struct compiled *c, size_t i, arena_t *a,
+                       char *line, block_t *prev, machine_t *cfg);
+// Re-initialize a block not allocated in an arena as a new block for line,
+// following prev (as in block_new_ref), reusing its memory: for walking a
+// program with a fixed set of blocks. b is unlinked from its old neighbors
+void block_recycle(block_t *b, char *line, block_t *prev);
 void block_free(block_t *b);
 void block_print(block_t *b, FILE *out);
 
@@ -49,12 +108,83 @@ void block_print(block_t *b, FILE *out);
 // Parsing the G-code string. Returns an integer for success/failure
 int block_parse(block_t *b);
 
+// block_parse is split in three phases, which can be called separately for
+// parsing many blocks concurrently:
+// 1. block_scan: tokenize the G-code string (only touches b, thread safe)
+// 2. block_inherit: link b after prev and inherit modal fields (sequential,
+//    prev must already be inherited)
+// 3. block_plan: geometry and velocity profile (thread safe once all the
+//    blocks are inherited)
+// block_scan and block_plan return the number of errors
+int block_scan(block_t *b);
+void block_inherit(block_t *b, block_t *prev);
+int block_plan(block_t *b);
+
 // Evaluate the value of lambda at a certaint time
 // also return speed in the parameter v
 data_t block_lambda(const block_t *b, data_t time, data_t *v);
+// Same as block_lambda, on a bare velocity profile
+data_t block_profile_lambda(const block_profile_t *prof, data_t time,
+                            data_t *v);
+// Walking a block at fixed sampling time: block_sampler_next returns lambda
+// and speed v at times t0, t0 + tq, t0 + 2tq... with the same values as
+// block_lambda (within rounding), but at constant cost: lambda and speed are
+// updated by forward differences, and the phase is only looked up at the
+// phase boundaries
+void block_sampler_init(block_sampler_t *s, const block_t *b, data_t t0);
+data_t block_sampler_next(block_sampler_t *s, data_t *v);
+
+// LOOK-AHEAD
+// Maximum speed (mm/s) for crossing the junction between the previous block
+// and b without stopping. The corner is taken as an arc tangent to both
+// blocks and within machine_error from the junction point, traveled at
+// centripetal acceleration machine_A; the speed is also limited by the
+// feedrate of the two blocks. It is 0 if either block is not a G01/G02/G03
+data_t block_junction(const block_t *b);
+// Highest speed (mm/s) a motion block can reach along its length, when
+// starting at speed v0; by symmetry, it is also the highest speed at which
+// it can be entered and still slow down to v0 at its end
+data_t block_reachable(const block_t *b, data_t v0);
+// Re-plan the velocity profile of a motion block (already planned) so that
+// it starts at speed vi and ends at speed vf (mm/s). The speeds must not
+// exceed the block feed, and must be reachable within the block length
+void block_set_speeds(block_t *b, data_t vi, data_t vf);
+
+// PATH SIMPLIFICATION
+// Merge into b (a planned G01 block) the following G01 blocks with the same
+// feedrate, spindle and tool, at most max of them, as long as the end points
+// of all the merged blocks stay within tol from the new segment of b, in
+// order. b then ends at the target of the last merged block and is planned
+// again; the merged blocks are unlinked from the list, but not freed (e.g.
+// they are released with their arena). Returns the number of merged blocks
+size_t block_merge(block_t *b, data_t tol, size_t max);
+// Replace b (a planned G01 block) and the following G01 blocks with the same
+// feedrate, spindle and tool, at most max of them, with a single G02/G03 arc
+// on the XY plane (helical if z changes), as long as the original path stays
+// within tol from it. Runs shorter than three blocks, or so straight that a
+// segment is within tol, are left alone. As in block_merge, the replaced
+// blocks are unlinked but not freed. Returns the number of replaced blocks
+size_t block_fit_arc(block_t *b, data_t tol, size_t max);
 
 // Interpolate lambda over three axes
+// CAREFUL: the result is allocated, use block_interpolate_v in loops
 point_t *block_interpolate(block_t *b, data_t lambda);
+// Same as block_interpolate, returning the point by value (no allocations)
+point_t block_interpolate_v(const block_t *b, data_t lambda);
+
+// BATCH SAMPLING
+// Samples are taken every tq on a timeline shared by all the blocks: the
+// samples of b are at t = t0 + k*tq <= dt, where t0 is the time carried over
+// from the previous block (0 for the first block). Only G01/G02/G03 blocks
+// have samples, the others take no time
+// Number of samples of b
+size_t block_samples(const block_t *b, data_t t0);
+// Time carried over to the next block, i.e. its t0
+data_t block_carry(const block_t *b, data_t t0);
+// Render the samples from..from+n-1 of b (fewer if b has less samples) into
+// the buffers, with no allocations. Returns the number of samples rendered
+size_t block_render(const block_t *b, data_t t0, size_t from, size_t n,
+                    const block_trajectory_t *out);
 
 
 // GETTERS =====================================================================
@@ -68,6 +198,16 @@ char *block_line(const block_t *b);
 size_t block_n(const block_t *b);
 point_t *block_center(const block_t *b);
 block_t *block_next(const block_t *b);
+block_t *block_prev(const block_t *b);
+point_t *block_target(const block_t *b);
+point_t *block_delta(const block_t *b);
+data_t block_feedrate(const block_t *b);
+data_t block_feed(const block_t *b);
+data_t block_spindle(const block_t *b);
+size_t block_tool(const block_t *b);
+data_t block_theta0(const block_t *b);
+data_t block_acc(const block_t *b);
+const block_profile_t *block_profile(const block_t *b);
 
 
 #endif // BLOCK_H
\ No newline at end of file
@@ -0,0 +1,239 @@
+//    ____                      _ _          _
+//   / ___|___  _ __ ___  _ __ (_) | ___  __| |
+//  | |   / _ \| '_ ` _ \| '_ \| | |/ _ \/ _` |
+//  | |__| (_) | | | | | | |_) | | |  __/ (_| |
+//   \____\___/|_| |_| |_| .__/|_|_|\___|\__,_|
+//                       |_|
+
+#include "compiled.h"
+
+//   ____            _                 _   _
+//  |  _ \  ___  ___| | __ _ _ __ __ _| |_(_) ___  _ __  ___
+//  | | | |/ _ \/ __| |/ _` | '__/ _` | __| |/ _ \| '_ \/ __|
+//  | |_| |  __/ (__| | (_| | | | (_| | |_| | (_) | | | \__ \
+//  |____/ \___|\___|_|\__,_|_|  \__,_|\__|_|\___/|_| |_|___/
+
+// Compiled program object structure
+// All the arrays live in a single allocation (data), one after the other
+typedef struct compiled {
+  size_t n;                  // number of blocks
+  data_t x0, y0, z0;         // starting point of the first block
+  void *data;                // memory holding all the arrays
+  size_t size;               // size of data
+  int own_data;              // true if data must be freed
+  block_t **blocks;          // original blocks
+  data_t *feedrate, *feed, *spindle;
+  data_t *x, *y, *z;         // targets
+  data_t *dx, *dy, *dz;      // deltas
+  data_t *cx, *cy;           // arc centers
+  data_t *length, *r, *theta0, *dtheta, *acc;
+  block_profile_t *prof;     // velocity profiles
+  size_t *num, *tool;        // block and tool numbers
+  uint8_t *type;             // block types
+} compiled_t;
+
+// STATIC FUNCTIONS (for internal use only) ====================================
+static size_t compiled_layout(compiled_t *c, char *base);
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+compiled_t *compiled_new(const program_t *p, const machine_t *cfg) {
+  assert(p && cfg);
+  compiled_t *c;
+  block_t *b;
+  size_t i;
+
+  if (program_load(p) == LOAD_STREAM || program_load(p) == LOAD_PIPELINE) {
+    fprintf(stderr, "ERROR: cannot compile a streaming program\n");
+    return NULL;
+  }
+  if (!(c = (compiled_t *)calloc(1, sizeof(compiled_t)))) {
+    perror("Could not create compiled program");
+    return NULL;
+  }
+  c->n = program_length(p);
+  c->size = compiled_layout(c, NULL);
+  c->data = malloc(c->size + 1);
+  c->own_data = 1;
+  c->blocks = (block_t **)malloc(c->n * sizeof(block_t *) + 1);
+  if (!c->data || !c->blocks) {
+    perror("Could not allocate compiled program");
+    compiled_free(c);
+    return NULL;
+  }
+  compiled_layout(c, (char *)c->data);
+  c->x0 = point_x(machine_zero(cfg));
+  c->y0 = point_y(machine_zero(cfg));
+  c->z0 = point_z(machine_zero(cfg));
+
+  for (i = 0, b = program_first(p); i < c->n && b; i++, b = block_next(b)) {
+    c->blocks[i] = b;
+    c->type[i] = (uint8_t)block_type(b);
+    c->num[i] = block_n(b);
+    c->tool[i] = block_tool(b);
+    c->feedrate[i] = block_feedrate(b);
+    c->feed[i] = block_feed(b);
+    c->spindle[i] = block_spindle(b);
+    c->x[i] = point_x(block_target(b));
+    c->y[i] = point_y(block_target(b));
+    c->z[i] = point_z(block_target(b));
+    c->dx[i] = point_x(block_delta(b));
+    c->dy[i] = point_y(block_delta(b));
+    c->dz[i] = point_z(block_delta(b));
+    c->cx[i] = point_x(block_center(b));
+    c->cy[i] = point_y(block_center(b));
+    c->length[i] = block_length(b);
+    c->r[i] = block_r(b);
+    c->theta0[i] = block_theta0(b);
+    c->dtheta[i] = block_dtheta(b);
+    c->acc[i] = block_acc(b);
+    c->prof[i] = *block_profile(b);
+  }
+  return c;
+}
+
+compiled_t *compiled_wrap(void *data, size_t n, const machine_t *cfg) {
+  assert(data && cfg);
+  compiled_t *c = (compiled_t *)calloc(1, sizeof(compiled_t));
+  if (!c) {
+    perror("Could not create compiled program");
+    return NULL;
+  }
+  c->n = n;
+  c->data = data;
+  c->size = compiled_layout(c, (char *)data);
+  c->own_data = 0;
+  c->blocks = NULL;
+  c->x0 = point_x(machine_zero(cfg));
+  c->y0 = point_y(machine_zero(cfg));
+  c->z0 = point_z(machine_zero(cfg));
+  return c;
+}
+
+void compiled_free(compiled_t *c) {
+  assert(c);
+  if (c->own_data)
+    free(c->data);
+  free(c->blocks);
+  free(c);
+  c = NULL;
+}
+
+
+// ALGORITHMS ==================================================================
+
+data_t compiled_lambda(const compiled_t *c, size_t i, data_t t, data_t *v) {
+  assert(c && i < c->n);
+  return block_profile_lambda(&c->prof[i], t, v);
+}
+
+int compiled_interpolate(const compiled_t *c, size_t i, data_t lambda,
+                         point_t *result) {
+  assert(c && i < c->n && result);
+  // the starting point is the previous target, or the machine zero
+  data_t x0 = i ? c->x[i - 1] : c->x0;
+  data_t y0 = i ? c->y[i - 1] : c->y0;
+  data_t z0 = i ? c->z[i - 1] : c->z0;
+
+  switch (c->type[i]) {
+  case LINE:
+    point_set_x(result, x0 + c->dx[i] * lambda);
+    point_set_y(result, y0 + c->dy[i] * lambda);
+    break;
+  case ARC_CW:
+  case ARC_CCW:
+    point_set_x(result, c->cx[i] + c->r[i] * cos(c->theta0[i] + c->dtheta[i] * lambda));
+    point_set_y(result, c->cy[i] + c->r[i] * sin(c->theta0[i] + c->dtheta[i] * lambda));
+    break;
+  default:
+    fprintf(stderr, "Unexpected block type!\n");
+    return EXIT_FAILURE;
+  }
+  point_set_z(result, z0 + c->dz[i] * lambda);
+  return EXIT_SUCCESS;
+}
+
+
+// GETTERS =====================================================================
+
+#define compiled_getter(typ, par, name) \
+typ compiled_##name(const compiled_t *c) { assert(c); return c->par; }
+
+compiled_getter(size_t, n, count);
+compiled_getter(const uint8_t *, type, type);
+compiled_getter(const size_t *, num, n);
+compiled_getter(const size_t *, tool, tool);
+compiled_getter(const data_t *, feedrate, feedrate);
+compiled_getter(const data_t *, feed, feed);
+compiled_getter(const data_t *, spindle, spindle);
+compiled_getter(const data_t *, x, x);
+compiled_getter(const data_t *, y, y);
+compiled_getter(const data_t *, z, z);
+compiled_getter(const data_t *, dx, dx);
+compiled_getter(const data_t *, dy, dy);
+compiled_getter(const data_t *, dz, dz);
+compiled_getter(const data_t *, cx, cx);
+compiled_getter(const data_t *, cy, cy);
+compiled_getter(const data_t *, length, length);
+compiled_getter(const data_t *, r, r);
+compiled_getter(const data_t *, theta0, theta0);
+compiled_getter(const data_t *, dtheta, dtheta);
+compiled_getter(const data_t *, acc, acc);
+compiled_getter(const block_profile_t *, prof, profile);
+
+compiled_getter(const void *, data, data);
+compiled_getter(size_t, size, size);
+
+block_t *compiled_block(const compiled_t *c, size_t i) {
+  assert(c && i < c->n);
+  return c->blocks ? c->blocks[i] : NULL;
+}
+
+
+
+//   ____  _        _   _         __
+//  / ___|| |_ __ _| |_(_) ___   / _|_   _ _ __   ___
+//  \___ \| __/ _` | __| |/ __| | |_| | | | '_ \ / __|
+//   ___) | || (_| | |_| | (__  |  _| |_| | | | | (__
+//  |____/ \__\__,_|\__|_|\___| |_|  \__,_|_| |_|\___|
+// Definitions for the static functions declared above
+
+// Point the arrays into the memory starting at base, and return the total
+// size. With base == NULL, only compute the size
+static size_t compiled_layout(compiled_t *c, char *base) {
+  size_t size = 0;
+#define compiled_array(field, typ)                           \
+  c->field = base ? (typ *)(base + size) : NULL;             \
+  size += (c->n * sizeof(typ) + 7) & ~(size_t)7;
+
+  // widest types first: every array stays aligned
+  compiled_array(prof, block_profile_t);
+  compiled_array(feedrate, data_t);
+  compiled_array(feed, data_t);
+  compiled_array(spindle, data_t);
+  compiled_array(x, data_t);
+  compiled_array(y, data_t);
+  compiled_array(z, data_t);
+  compiled_array(dx, data_t);
+  compiled_array(dy, data_t);
+  compiled_array(dz, data_t);
+  compiled_array(cx, data_t);
+  compiled_array(cy, data_t);
+  compiled_array(length, data_t);
+  compiled_array(r, data_t);
+  compiled_array(theta0, data_t);
+  compiled_array(dtheta, data_t);
+  compiled_array(acc, data_t);
+  compiled_array(num, size_t);
+  compiled_array(tool, size_t);
+  compiled_array(type, uint8_t);
+#undef compiled_array
+  return size;
+}
@@ -0,0 +1,96 @@
+//    ____                      _ _          _
+//   / ___|___  _ __ ___  _ __ (_) | ___  __| |
+//  | |   / _ \| '_ ` _ \| '_ \| | |/ _ \/ _` |
+//  | |__| (_) | | | | | | |_) | | |  __/ (_| |
+//   \____\___/|_| |_| |_| .__/|_|_|\___|\__,_|
+//                       |_|
+//  Compiled program class
+
+#ifndef COMPILED_H
+#define COMPILED_H
+
+#include "defines.h"
+#include "block.h"
+#include "program.h"
+#include "machine.h"
+
+//   _____                      
+//  |_   _|   _ _ __   ___  ___ 
+//    | || | | | '_ \ / _ \/ __|
+//    | || |_| | |_) |  __/\__ \
+//    |_| \__, | .__/ \___||___/
+//        |___/|_|              
+
+// Opaque structure: a parsed program stored as a struct of arrays. Each
+// array has one element per block, and block i of the program is at index i
+// of every array, so that sweeping a field over the whole program reads
+// contiguous memory instead of chasing block and point pointers.
+typedef struct compiled compiled_t;
+
+
+//   _____                 _   _                 
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___ 
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+// Compile a parsed program (not LOAD_STREAM). The program must outlive the
+// compiled object only if compiled_block is used
+compiled_t *compiled_new(const program_t *p, const machine_t *cfg);
+void compiled_free(compiled_t *c);
+
+// Wrap the arrays of n blocks stored in data (as given by compiled_data, e.g.
+// from a file), without copying them. data must outlive the compiled object,
+// which has no original blocks (compiled_block returns NULL)
+compiled_t *compiled_wrap(void *data, size_t n, const machine_t *cfg);
+
+// ALGORITHMS ==================================================================
+
+// Same as block_lambda, for block i
+data_t compiled_lambda(const compiled_t *c, size_t i, data_t time, data_t *v);
+
+// Same as block_interpolate, for block i, but the result goes in the given
+// point (no allocation). Returns EXIT_FAILURE on non-motion blocks
+int compiled_interpolate(const compiled_t *c, size_t i, data_t lambda,
+                         point_t *result);
+
+// GETTERS =====================================================================
+
+// Number of blocks (length of each array)
+size_t compiled_count(const compiled_t *c);
+
+// The original block at index i, for the block_* getters
+block_t *compiled_block(const compiled_t *c, size_t i);
+
+// The memory holding all the arrays, and its size in bytes
+const void *compiled_data(const compiled_t *c);
+size_t compiled_size(const compiled_t *c);
+
+// Arrays, one element per block (see the same block_* getters)
+const uint8_t *compiled_type(const compiled_t *c); // block_type_t values
+const size_t *compiled_n(const compiled_t *c);
+const size_t *compiled_tool(const compiled_t *c);
+const data_t *compiled_feedrate(const compiled_t *c);
+const data_t *compiled_feed(const compiled_t *c);
+const data_t *compiled_spindle(const compiled_t *c);
+const data_t *compiled_x(const compiled_t *c);  // target
+const data_t *compiled_y(const compiled_t *c);
+const data_t *compiled_z(const compiled_t *c);
+const data_t *compiled_dx(const compiled_t *c); // delta
+const data_t *compiled_dy(const compiled_t *c);
+const data_t *compiled_dz(const compiled_t *c);
+const data_t *compiled_cx(const compiled_t *c); // arc center
+const data_t *compiled_cy(const compiled_t *c);
+const data_t *compiled_length(const compiled_t *c);
+const data_t *compiled_r(const compiled_t *c);
+const data_t *compiled_theta0(const compiled_t *c);
+const data_t *compiled_dtheta(const compiled_t *c);
+const data_t *compiled_acc(const compiled_t *c);
+// profile parameters are always used together, so they are kept as an
+// array of structures
+const block_profile_t *compiled_profile(const compiled_t *c);
+
+
+#endif // COMPILED_H
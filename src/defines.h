@@ -0,0 +1,45 @@
+// WARNING: This file (defines.h) is automatically generated by Cmake. DO NOT EDIT
+// WARNING: Any edit will be lost on running Cmake again.
+// WARNING: Instead, do edit defines.h.in
+
+#ifndef DEFINES_H
+#define DEFINES_H
+
+// Needed for asprintf
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include <string.h>
+
+typedef double data_t;
+
+//   _____                      
+//  |_   _|   _ _ __   ___  ___ 
+//    | || | | | '_ \ / _ \/ __|
+//    | || |_| | |_) |  __/\__ \
+//    |_| \__, | .__/ \___||___/
+//        |___/|_|              
+//
+
+typedef double data_t;
+
+//    ____                 _                                             
+//   / ___|_ __ ___   __ _| | _____   _ __ ___   __ _  ___ _ __ ___  ___ 
+//  | |   | '_ ` _ \ / _` | |/ / _ \ | '_ ` _ \ / _` |/ __| '__/ _ \/ __|
+//  | |___| | | | | | (_| |   <  __/ | | | | | | (_| | (__| | | (_) \__ \
+//   \____|_| |_| |_|\__,_|_|\_\___| |_| |_| |_|\__,_|\___|_|  \___/|___/
+//
+
+#define VERSION "1.0"
+#define BUILD_TYPE "Debug"
+
+#endif
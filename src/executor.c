@@ -0,0 +1,571 @@
+//   _____                     _
+//  | ____|_  _____  ___ _   _| |_ ___  _ __
+//  |  _| \ \/ / _ \/ __| | | | __/ _ \| '__|
+//  | |___ >  <  __/ (__| |_| | || (_) | |
+//  |_____/_/\_\___|\___|\__,_|\__\___/|_|
+// executor.c
+
+#include "executor.h"
+#include "block.h"
+#include "histogram.h"
+#include "ring.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+
+//   ____            _                 _   _
+//  |  _ \  ___  ___| | __ _ _ __ __ _| |_(_) ___  _ __  ___
+//  | | | |/ _ \/ __| |/ _` | '__/ _` | __| |/ _ \| '_ \/ __|
+//  | |_| |  __/ (__| | (_| | | | (_| | |_| | (_) | | | \__ \
+//  |____/ \___|\___|_|\__,_|_|  \__,_|\__|_|\___/|_| |_|___/
+
+// Sleeping until an absolute time is only available on Linux: elsewhere,
+// the time left is slept instead
+#if defined(__linux)
+#define HAVE_ABSTIME_SLEEP
+#endif
+
+// Stack touched before running, so that its pages are already mapped
+#define EXECUTOR_STACK (64 * 1024)
+
+// Position along a program, for computing its setpoints one at a time
+typedef struct {
+  program_t *p;      // program being executed
+  machine_t *cfg;    // machine configuration
+  block_t *b;        // current block (NULL before the first one)
+  block_sampler_t s; // sampler of b
+  size_t k, m;       // next sample of b and number of samples of b
+  data_t t0;         // time carried over from the previous block
+  data_t tq;         // sampling time
+  size_t count;      // setpoints computed so far
+  data_t rapid;      // time of the rapid blocks passed, not sampled (s)
+} executor_cursor_t;
+
+// Executor object structure
+typedef struct executor {
+  machine_t *cfg;        // machine configuration
+  executor_output_t out; // setpoints receiver (or NULL)
+  void *data;            // argument of out
+  int priority;          // SCHED_FIFO priority (0 for normal scheduling)
+  int cpu;               // CPU of the loop (-1 for any)
+  int lock;              // true to lock the memory
+  size_t buffer;         // setpoints computed ahead (0 for no planner thread)
+  int simulate;          // true to run on the virtual clock
+  struct timespec clock; // virtual clock (simulation)
+  executor_cursor_t cur; // position along the program
+  ring_t *ring;          // setpoints from the planner thread (or NULL)
+  uint64_t period;       // machine_tq (ns)
+  size_t cycles;         // setpoints sent
+  size_t overruns;       // deadlines missed
+  size_t underruns;      // periods with no setpoint ready
+  size_t high_water;     // most setpoints ever computed ahead
+  histogram_t *latency;  // wake up time after the deadlines (ns)
+  histogram_t *busy;     // time spent working in each period (ns)
+  uint64_t *trace;       // time between wake ups of the first periods (ns)
+  size_t trace_len;      // size of trace
+  size_t traced;         // periods in trace
+  struct timespec wake;  // last wake up
+  uint64_t elapsed;      // duration of the last run (ns)
+} executor_t;
+
+// Programs shared by the threads of executor_simulate_many: each thread
+// takes the next program not yet simulated
+typedef struct {
+  const char *const *files; // program files
+  size_t n;                 // number of files
+  machine_t *cfg;           // machine configuration (read only)
+  size_t lookahead;         // look-ahead window of every program
+  int simplify;             // path simplifications of every program
+  int cache;                // true to use the compiled cache
+  executor_report_t *rep;   // reports, one per file
+  atomic_size_t next;       // next file to be simulated
+  atomic_size_t failures;   // number of failed simulations
+} executor_batch_t;
+
+// STATIC FUNCTIONS (for internal use only) ====================================
+static void executor_setup(executor_t *e);
+static int executor_next(executor_cursor_t *c, executor_setpoint_t *sp);
+static void executor_cycle(executor_t *e, struct timespec *next,
+                           struct timespec *start, executor_setpoint_t *sp);
+static void *executor_planner(void *arg);
+static int executor_run_buffered(executor_t *e, struct timespec *next);
+static void executor_prefault(void);
+static void executor_now(executor_t *e, struct timespec *ts);
+static void executor_sleep(executor_t *e, const struct timespec *until);
+static void timespec_add(struct timespec *ts, uint64_t ns);
+static int64_t timespec_ns(const struct timespec *a, const struct timespec *b);
+static int timespec_after(const struct timespec *a, const struct timespec *b);
+static void *executor_simulate_worker(void *arg);
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+executor_t *executor_new(machine_t *cfg) {
+  assert(cfg);
+  executor_t *e = (executor_t *)calloc(1, sizeof(executor_t));
+  if (!e) {
+    perror("Could not create executor");
+    return NULL;
+  }
+  e->cfg = cfg;
+  e->out = NULL;
+  e->data = NULL;
+  e->priority = 0;
+  e->cpu = -1;
+  e->lock = 0;
+  e->buffer = 0;
+  e->simulate = 0;
+  e->ring = NULL;
+  e->trace = NULL;
+  e->trace_len = e->traced = 0;
+  e->latency = histogram_new();
+  e->busy = histogram_new();
+  if (!e->latency || !e->busy) {
+    executor_free(e);
+    return NULL;
+  }
+  return e;
+}
+
+void executor_free(executor_t *e) {
+  assert(e);
+  if (e->latency)
+    histogram_free(e->latency);
+  if (e->busy)
+    histogram_free(e->busy);
+  free(e->trace);
+  free(e);
+}
+
+// SETTINGS ====================================================================
+
+void executor_set_output(executor_t *e, executor_output_t out, void *data) {
+  assert(e);
+  e->out = out;
+  e->data = data;
+}
+
+void executor_set_priority(executor_t *e, int priority) {
+  assert(e);
+  e->priority = priority;
+}
+
+void executor_set_cpu(executor_t *e, int cpu) {
+  assert(e);
+  e->cpu = cpu;
+}
+
+void executor_set_lock(executor_t *e, int lock) {
+  assert(e);
+  e->lock = lock;
+}
+
+void executor_set_buffer(executor_t *e, size_t setpoints) {
+  assert(e);
+  e->buffer = setpoints;
+}
+
+void executor_set_simulate(executor_t *e, int simulate) {
+  assert(e);
+  e->simulate = simulate;
+}
+
+int executor_set_trace(executor_t *e, size_t periods) {
+  assert(e);
+  uint64_t *trace = NULL;
+  if (periods && !(trace = (uint64_t *)malloc(periods * sizeof(uint64_t)))) {
+    perror("Could not allocate the trace");
+    return EXIT_FAILURE;
+  }
+  free(e->trace);
+  e->trace = trace;
+  e->trace_len = periods;
+  e->traced = 0;
+  return EXIT_SUCCESS;
+}
+
+// PROCESSING ==================================================================
+
+int executor_run(executor_t *e, program_t *p) {
+  assert(e && p);
+  executor_setpoint_t sp;
+  struct timespec next, start, begin;
+  data_t tq = machine_tq(e->cfg);
+
+  if ((e->period = (uint64_t)(tq * 1e9 + 0.5)) == 0) {
+    fprintf(stderr, "ERROR: invalid sampling time %g\n", tq);
+    return EXIT_FAILURE;
+  }
+  e->cycles = e->overruns = e->underruns = e->high_water = 0;
+  e->traced = 0;
+  e->elapsed = 0;
+  e->clock.tv_sec = e->clock.tv_nsec = 0;
+  histogram_reset(e->latency);
+  histogram_reset(e->busy);
+  program_reset(p);
+  memset(&e->cur, 0, sizeof(e->cur));
+  e->cur.p = p;
+  e->cur.cfg = e->cfg;
+  e->cur.tq = tq;
+  // on the virtual clock computing takes no time: nothing to compute ahead
+  if (e->buffer && !e->simulate)
+    return executor_run_buffered(e, &next);
+
+  if (!e->simulate)
+    executor_setup(e);
+  executor_now(e, &start);
+  e->wake = next = begin = start;
+  timespec_add(&next, e->period);
+  // compute each setpoint ahead of its deadline
+  while (executor_next(&e->cur, &sp))
+    executor_cycle(e, &next, &start, &sp);
+  e->elapsed = timespec_ns(&e->wake, &begin);
+  return program_failed(p) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// GETTERS =====================================================================
+
+size_t executor_cycles(const executor_t *e) {
+  assert(e);
+  return e->cycles;
+}
+
+size_t executor_overruns(const executor_t *e) {
+  assert(e);
+  return e->overruns;
+}
+
+size_t executor_underruns(const executor_t *e) {
+  assert(e);
+  return e->underruns;
+}
+
+size_t executor_high_water(const executor_t *e) {
+  assert(e);
+  return e->high_water;
+}
+
+data_t executor_elapsed(const executor_t *e) {
+  assert(e);
+  return e->elapsed / 1e9;
+}
+
+data_t executor_rapid(const executor_t *e) {
+  assert(e);
+  return e->cur.rapid;
+}
+
+const histogram_t *executor_latency(const executor_t *e) {
+  assert(e);
+  return e->latency;
+}
+
+const histogram_t *executor_busy(const executor_t *e) {
+  assert(e);
+  return e->busy;
+}
+
+// OUTPUT ======================================================================
+
+int executor_write_trace(const executor_t *e, FILE *out) {
+  assert(e && out);
+  if (fprintf(out, "n, dt\n") < 0)
+    return EXIT_FAILURE;
+  for (size_t i = 0; i < e->traced; i++) {
+    if (fprintf(out, "%zu, %.9f\n", i, e->trace[i] / 1e9) < 0)
+      return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// BATCH =======================================================================
+
+size_t executor_simulate_many(const char *const *files, size_t n,
+                              machine_t *cfg, size_t lookahead, int simplify,
+                              int cache, size_t threads,
+                              executor_report_t *rep) {
+  assert(files && cfg && rep);
+  executor_batch_t batch = {.files = files, .n = n, .cfg = cfg,
+                            .lookahead = lookahead, .simplify = simplify,
+                            .cache = cache, .rep = rep};
+  pthread_t *tids;
+  int *running;
+  size_t i;
+
+  atomic_init(&batch.next, 0);
+  atomic_init(&batch.failures, 0);
+  if (threads == 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = ncpu > 0 ? ncpu : 1;
+  }
+  threads = MAX(MIN(threads, n), 1);
+  tids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+  running = (int *)calloc(threads, sizeof(int));
+  // the calling thread works as well; if no thread can be created, it does
+  // all the work
+  for (i = 1; tids && running && i < threads; i++)
+    running[i] = !pthread_create(&tids[i], NULL, executor_simulate_worker,
+                                 &batch);
+  executor_simulate_worker(&batch);
+  for (i = 1; tids && running && i < threads; i++) {
+    if (running[i])
+      pthread_join(tids[i], NULL);
+  }
+  free(tids);
+  free(running);
+  return atomic_load(&batch.failures);
+}
+
+
+
+//   ____  _        _   _         __
+//  / ___|| |_ __ _| |_(_) ___   / _|_   _ _ __   ___
+//  \___ \| __/ _` | __| |/ __| | |_| | | | '_ \ / __|
+//   ___) | || (_| | |_| | (__  |  _| |_| | | | | (__
+//  |____/ \__\__,_|\__|_|\___| |_|  \__,_|_| |_|\___|
+// Definitions for the static functions declared above
+
+// Apply the real-time settings to the calling thread
+static void executor_setup(executor_t *e) {
+  if (e->lock) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE))
+      perror("WARNING: could not lock memory");
+    executor_prefault();
+  }
+#if defined(__linux)
+  if (e->cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(e->cpu, &set);
+    if ((errno = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)))
+      perror("WARNING: could not set the CPU affinity");
+  }
+#endif
+  if (e->priority > 0) {
+    struct sched_param param = {.sched_priority = e->priority};
+    if ((errno = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)))
+      perror("WARNING: could not set the real-time priority");
+  }
+}
+
+// Compute the next setpoint; returns 0 at the end of the program
+static int executor_next(executor_cursor_t *c, executor_setpoint_t *sp) {
+  point_t pos;
+  // move to the next block with samples left
+  while (!c->b || c->k == c->m) {
+    if (c->b)
+      c->t0 = block_carry(c->b, c->t0);
+    if (!(c->b = program_next(c->p)))
+      return 0;
+    if (block_type(c->b) == RAPID)
+      c->rapid += program_rapid_time(c->b, c->cfg);
+    c->k = 0;
+    if ((c->m = block_samples(c->b, c->t0)))
+      block_sampler_init(&c->s, c->b, c->t0);
+  }
+  sp->t = c->count * c->tq;
+  sp->n = block_n(c->b);
+  sp->lambda = block_sampler_next(&c->s, &sp->feed);
+  pos = block_interpolate_v(c->b, sp->lambda);
+  sp->x = point_x(&pos);
+  sp->y = point_y(&pos);
+  sp->z = point_z(&pos);
+  c->k++;
+  c->count++;
+  return 1;
+}
+
+// One period: wait for the deadline next, then send sp. With a ring, sp is
+// taken from it after the deadline, if there is one. start is when the work
+// of this period began (and becomes when the next one begins). Only timings
+// are recorded: no I/O, no allocations
+static void executor_cycle(executor_t *e, struct timespec *next,
+                           struct timespec *start, executor_setpoint_t *sp) {
+  struct timespec now, wake;
+  int64_t busy, late;
+  int ready = 1;
+  executor_now(e, &now);
+  busy = timespec_ns(&now, start);
+  if (timespec_after(&now, next))
+    e->overruns++;
+  else
+    executor_sleep(e, next);
+  executor_now(e, &wake);
+  if (e->ring)
+    ready = !ring_pop(e->ring, sp);
+  if (ready) {
+    if (e->out)
+      e->out(sp, e->data);
+    e->cycles++;
+  }
+  executor_now(e, start);
+  busy += timespec_ns(start, &wake);
+  late = timespec_ns(&wake, next);
+  histogram_record(e->latency, late > 0 ? late : 0);
+  histogram_record(e->busy, busy > 0 ? busy : 0);
+  if (e->traced < e->trace_len)
+    e->trace[e->traced++] = timespec_ns(&wake, &e->wake);
+  e->wake = wake;
+  timespec_add(next, e->period);
+}
+
+// Planner thread: compute the setpoints and push them to the ring, waiting
+// a fraction of the period whenever it is full
+static void *executor_planner(void *arg) {
+  executor_t *e = (executor_t *)arg;
+  executor_setpoint_t sp;
+  struct timespec pause = {0, (long)(e->cur.tq * 1e9 / 4)};
+  while (executor_next(&e->cur, &sp)) {
+    while (ring_push(e->ring, &sp))
+      nanosleep(&pause, NULL);
+  }
+  ring_close(e->ring);
+  return NULL;
+}
+
+// Run with a planner thread computing the setpoints ahead: the loop only
+// takes them from the ring. The loop starts once the ring is full (or holds
+// the whole program); afterwards, a period with no setpoint ready is an
+// underrun, and the setpoint is sent in a later period
+static int executor_run_buffered(executor_t *e, struct timespec *next) {
+  executor_setpoint_t sp;
+  struct timespec start, begin, pause = {0, (long)(e->period / 4)};
+  pthread_t tid;
+
+  if (!(e->ring = ring_new(e->buffer)))
+    return EXIT_FAILURE;
+  // the planner is started before the real-time settings, so that it does
+  // not inherit them
+  if ((errno = pthread_create(&tid, NULL, executor_planner, e))) {
+    perror("Could not start the planner thread");
+    ring_free(e->ring);
+    e->ring = NULL;
+    return EXIT_FAILURE;
+  }
+  executor_setup(e);
+  while (ring_size(e->ring) < ring_capacity(e->ring) && !ring_done(e->ring))
+    nanosleep(&pause, NULL);
+  executor_now(e, &start);
+  e->wake = *next = begin = start;
+  timespec_add(next, e->period);
+  while (!ring_done(e->ring))
+    executor_cycle(e, next, &start, &sp);
+  e->elapsed = timespec_ns(&e->wake, &begin);
+  pthread_join(tid, NULL);
+  e->underruns = ring_underruns(e->ring);
+  e->high_water = ring_high_water(e->ring);
+  ring_free(e->ring);
+  e->ring = NULL;
+  return program_failed(e->cur.p) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Touch the stack the loop will use, so that its pages are mapped (and,
+// after mlockall, stay so)
+static void executor_prefault(void) {
+  volatile unsigned char stack[EXECUTOR_STACK];
+  for (size_t i = 0; i < sizeof(stack); i += 4096)
+    stack[i] = 0;
+}
+
+// Current time: CLOCK_MONOTONIC, or the virtual clock when simulating
+static void executor_now(executor_t *e, struct timespec *ts) {
+  if (e->simulate)
+    *ts = e->clock;
+  else
+    clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+// Sleep until the given time of executor_now. The virtual clock just jumps
+// there: the time spent working does not count on it, so deadlines are
+// never missed
+static void executor_sleep(executor_t *e, const struct timespec *until) {
+  if (e->simulate) {
+    if (timespec_after(until, &e->clock))
+      e->clock = *until;
+    return;
+  }
+#ifdef HAVE_ABSTIME_SLEEP
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, until, NULL) ==
+         EINTR)
+    ;
+#else
+  struct timespec now, left;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!timespec_after(until, &now))
+    return;
+  left.tv_sec = until->tv_sec - now.tv_sec;
+  left.tv_nsec = until->tv_nsec - now.tv_nsec;
+  if (left.tv_nsec < 0) {
+    left.tv_sec--;
+    left.tv_nsec += 1000000000L;
+  }
+  while (nanosleep(&left, &left) && errno == EINTR)
+    ;
+#endif
+}
+
+static void timespec_add(struct timespec *ts, uint64_t ns) {
+  ns += ts->tv_nsec;
+  ts->tv_sec += ns / 1000000000ULL;
+  ts->tv_nsec = ns % 1000000000ULL;
+}
+
+// a - b in ns
+static int64_t timespec_ns(const struct timespec *a, const struct timespec *b) {
+  return (int64_t)(a->tv_sec - b->tv_sec) * 1000000000LL +
+         (a->tv_nsec - b->tv_nsec);
+}
+
+// True if a is later than b
+static int timespec_after(const struct timespec *a, const struct timespec *b) {
+  return a->tv_sec > b->tv_sec ||
+         (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+// Simulate the programs of a batch until there are none left, with an
+// executor of this thread
+static void *executor_simulate_worker(void *arg) {
+  executor_batch_t *batch = (executor_batch_t *)arg;
+  executor_t *e = executor_new(batch->cfg);
+  executor_report_t *rep;
+  program_t *p;
+  size_t i;
+  if (e)
+    executor_set_simulate(e, 1);
+  while ((i = atomic_fetch_add(&batch->next, 1)) < batch->n) {
+    rep = &batch->rep[i];
+    memset(rep, 0, sizeof(*rep));
+    rep->failed = 1;
+    if (e && (p = program_new(batch->files[i]))) {
+      program_set_load(p, LOAD_MMAP);
+      program_set_lookahead(p, batch->lookahead);
+      program_set_simplify(p, batch->simplify);
+      program_set_cache(p, batch->cache);
+      if (!program_parse(p, batch->cfg) && !executor_run(e, p)) {
+        rep->feed = executor_elapsed(e);
+        rep->rapid = executor_rapid(e);
+        rep->time = rep->feed + rep->rapid;
+        rep->setpoints = executor_cycles(e);
+        rep->failed = 0;
+      }
+      rep->errors = program_errors(p);
+      program_free(p);
+    }
+    if (rep->failed)
+      atomic_fetch_add(&batch->failures, 1);
+  }
+  if (e)
+    executor_free(e);
+  return NULL;
+}
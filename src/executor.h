@@ -0,0 +1,157 @@
+//   _____                     _
+//  | ____|_  _____  ___ _   _| |_ ___  _ __
+//  |  _| \ \/ / _ \/ __| | | | __/ _ \| '__|
+//  | |___ >  <  __/ (__| |_| | || (_) | |
+//  |_____/_/\_\___|\___|\__,_|\__\___/|_|
+//  Real-time execution of a program
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include "defines.h"
+#include "histogram.h"
+#include "machine.h"
+#include "program.h"
+
+//   _____
+//  |_   _|   _ _ __   ___  ___
+//    | || | | | '_ \ / _ \/ __|
+//    | || |_| | |_) |  __/\__ \
+//    |_| \__, | .__/ \___||___/
+//        |___/|_|
+
+// Opaque structure: runs a program at the machine sampling time, sending a
+// setpoint every machine_tq (see executor_run)
+typedef struct executor executor_t;
+
+// Setpoint of a sampling period. As in block_render, rapid blocks are not
+// sampled, so the setpoint jumps to the rapid target
+typedef struct {
+  data_t t;       // time from the program start
+  size_t n;       // block number (N word)
+  data_t lambda;  // curvilinear abscissa within the block
+  data_t feed;    // actual feedrate (mm/min)
+  data_t x, y, z; // position
+} executor_setpoint_t;
+
+// Receives the setpoints, from the real-time loop: it must return well
+// within machine_tq, so it must not block (e.g. on I/O)
+typedef void (*executor_output_t)(const executor_setpoint_t *sp, void *data);
+
+// Result of the simulation of a program (see executor_simulate_many)
+typedef struct {
+  data_t time;             // cycle time: feed plus rapid (s)
+  data_t feed;             // simulated duration (s)
+  data_t rapid;            // time of the G00 blocks (s), see executor_rapid
+  size_t setpoints;        // setpoints sent
+  program_errors_t errors; // errors found parsing the program
+  int failed;              // true if it could not be parsed or run
+} executor_report_t;
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+executor_t *executor_new(machine_t *cfg);
+void executor_free(executor_t *e);
+
+// SETTINGS ====================================================================
+// The real-time settings apply to the thread calling executor_run. Those
+// needing privileges (priority, memory locking) only print a warning when
+// they cannot be applied, and the program is run anyway
+
+// function receiving the setpoints (default: none)
+void executor_set_output(executor_t *e, executor_output_t out, void *data);
+// SCHED_FIFO priority of the loop, 1 to 99 (default: 0, normal scheduling)
+void executor_set_priority(executor_t *e, int priority);
+// CPU the loop is pinned to (default: -1, any)
+void executor_set_cpu(executor_t *e, int cpu);
+// lock all the process memory (mlockall) and pre-fault the stack before
+// running, so that the loop does not page fault (default: 0, disabled)
+void executor_set_lock(executor_t *e, int lock);
+// compute up to setpoints setpoints ahead in a planner thread, so that the
+// variable cost of parsing (LOAD_STREAM), planning and interpolation does
+// not delay the loop (default: 0, everything runs in the loop). The planner
+// thread does not get the real-time settings. With a LOAD_PIPELINE program,
+// it is the last stage of the pipeline: it only samples the planned blocks
+void executor_set_buffer(executor_t *e, size_t setpoints);
+// run on a virtual clock rather than in real time (default: 0, disabled):
+// the loop is the same, but sleeping moves the clock to the deadline at
+// once, so the program runs as fast as the CPU allows, with the same
+// setpoints at the same times. The real-time settings and the buffer are
+// not used (computing takes no time on the virtual clock), and latency,
+// busy time and overruns are all zero
+void executor_set_simulate(executor_t *e, int simulate);
+// keep the time between the wake ups of the first periods periods (see
+// executor_write_trace); the memory is allocated here, not while running
+// (default: 0, no trace). Returns EXIT_SUCCESS/EXIT_FAILURE
+int executor_set_trace(executor_t *e, size_t periods);
+
+// PROCESSING ==================================================================
+
+// Run a parsed program from its start: every machine_tq, at absolute
+// deadlines (so that delays do not pile up), the next setpoint is sent to
+// the output; between deadlines the thread sleeps. Setpoints are computed
+// before their deadline: a deadline missed when a setpoint is ready is
+// counted as an overrun, and the loop catches up at once, without skipping
+// any setpoint. With a buffer (see executor_set_buffer), setpoints are
+// taken from a lock-free ring filled by the planner thread: the loop starts
+// with a full ring, and a period with the ring empty is an underrun: the
+// machine holds the last setpoint, and the next one is sent a period later.
+// Each period, the wake up latency and the time spent working are recorded
+// in histograms (see executor_latency), with no I/O nor allocations.
+// Returns EXIT_SUCCESS/EXIT_FAILURE (also when the program stops at a
+// parsing error, see program_failed)
+int executor_run(executor_t *e, program_t *p);
+
+// GETTERS =====================================================================
+
+// Setpoints sent by the last executor_run
+size_t executor_cycles(const executor_t *e);
+// Deadlines missed by the last executor_run
+size_t executor_overruns(const executor_t *e);
+// Periods with no setpoint ready in the last executor_run with a buffer
+size_t executor_underruns(const executor_t *e);
+// Most setpoints computed ahead in the last executor_run with a buffer
+size_t executor_high_water(const executor_t *e);
+// Duration of the last executor_run (s), from the first period to the last
+// wake up, on its clock: with executor_set_simulate, the simulated time
+data_t executor_elapsed(const executor_t *e);
+// Time of the G00 blocks of the last executor_run (s): they are not sampled,
+// so it is not part of executor_elapsed, and it is estimated as by
+// program_estimate
+data_t executor_rapid(const executor_t *e);
+// Time between each deadline and the wake up of the loop (ns), in the last
+// executor_run (also while running, from any thread)
+const histogram_t *executor_latency(const executor_t *e);
+// Time spent working in each period (ns): computing or taking the setpoint
+// and sending it, in the last executor_run (also while running)
+const histogram_t *executor_busy(const executor_t *e);
+
+// OUTPUT ======================================================================
+
+// Write the trace of the last executor_run as CSV, with the period number n
+// and the time dt since the previous wake up (s), as the timed examples do
+// (see MATLAB/execution_time_analysis.m)
+int executor_write_trace(const executor_t *e, FILE *out);
+
+// BATCH =======================================================================
+
+// Simulate n program files in parallel (see executor_set_simulate), on
+// threads threads (0 for one per online CPU), each with its own executor
+// and the given look-ahead window, simplifications and cache setting (see
+// program_set_simplify and program_set_cache); cfg is shared, and only read.
+// Programs are parsed with LOAD_MMAP, and those with errors are not run.
+// rep[i] is the report of files[i]. Returns the number of failures
+size_t executor_simulate_many(const char *const *files, size_t n,
+                              machine_t *cfg, size_t lookahead, int simplify,
+                              int cache, size_t threads,
+                              executor_report_t *rep);
+
+
+#endif // EXECUTOR_H
@@ -0,0 +1,243 @@
+//   _   _ _     _
+//  | | | (_)___| |_ ___   __ _ _ __ __ _ _ __ ___
+//  | |_| | / __| __/ _ \ / _` | '__/ _` | '_ ` _ \
+//  |  _  | \__ \ || (_) | (_| | | | (_| | | | | | |
+//  |_| |_|_|___/\__\___/ \__, |_|  \__,_|_| |_| |_|
+//                        |___/
+// histogram.c
+
+#include "histogram.h"
+#include <stdatomic.h>
+
+
+//   ____            _                 _   _
+//  |  _ \  ___  ___| | __ _ _ __ __ _| |_(_) ___  _ __  ___
+//  | | | |/ _ \/ __| |/ _` | '__/ _` | __| |/ _ \| '_ \/ __|
+//  | |_| |  __/ (__| | (_| | | | (_| | |_| | (_) | | | \__ \
+//  |____/ \___|\___|_|\__,_|_|  \__,_|\__|_|\___/|_| |_|___/
+
+// Values below HISTOGRAM_LINEAR have a bucket each, then each power of two
+// from HISTOGRAM_LINEAR to 2^63 has HISTOGRAM_SUB buckets
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_LINEAR (2 * HISTOGRAM_SUB)
+#define HISTOGRAM_BUCKETS (HISTOGRAM_LINEAR + (63 - 4 + 1) * HISTOGRAM_SUB)
+
+// Histogram object structure
+typedef struct histogram {
+  atomic_uint_fast64_t bucket[HISTOGRAM_BUCKETS]; // counts
+  atomic_uint_fast64_t count;                     // number of values
+  atomic_uint_fast64_t sum;                       // sum of the values
+  atomic_uint_fast64_t max;                       // largest value
+} histogram_t;
+
+// STATIC FUNCTIONS (for internal use only) ====================================
+static size_t histogram_bucket(uint64_t value);
+static uint64_t histogram_lower(size_t i);
+static uint64_t histogram_upper(size_t i);
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+histogram_t *histogram_new(void) {
+  histogram_t *h = (histogram_t *)malloc(sizeof(histogram_t));
+  if (!h) {
+    perror("Could not create histogram");
+    return NULL;
+  }
+  histogram_reset(h);
+  return h;
+}
+
+void histogram_free(histogram_t *h) {
+  assert(h);
+  free(h);
+}
+
+void histogram_reset(histogram_t *h) {
+  assert(h);
+  for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    atomic_init(&h->bucket[i], 0);
+  atomic_init(&h->count, 0);
+  atomic_init(&h->sum, 0);
+  atomic_init(&h->max, 0);
+}
+
+// RECORDING ===================================================================
+
+void histogram_record(histogram_t *h, uint64_t value) {
+  assert(h);
+  uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->bucket[histogram_bucket(value)], 1,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->sum, value, memory_order_relaxed);
+  // with a single writer, the exchange succeeds at the first attempt
+  while (value > max && !atomic_compare_exchange_weak_explicit(
+                            &h->max, &max, value, memory_order_relaxed,
+                            memory_order_relaxed))
+    ;
+}
+
+// STATISTICS ==================================================================
+
+uint64_t histogram_count(const histogram_t *h) {
+  assert(h);
+  return atomic_load_explicit(&h->count, memory_order_relaxed);
+}
+
+uint64_t histogram_max(const histogram_t *h) {
+  assert(h);
+  return atomic_load_explicit(&h->max, memory_order_relaxed);
+}
+
+double histogram_mean(const histogram_t *h) {
+  assert(h);
+  uint64_t n = histogram_count(h);
+  return n ? atomic_load_explicit(&h->sum, memory_order_relaxed) / (double)n
+           : 0;
+}
+
+uint64_t histogram_percentile(const histogram_t *h, double p) {
+  assert(h && p > 0 && p <= 100);
+  uint64_t n = histogram_count(h), max = histogram_max(h), seen = 0;
+  uint64_t rank = (uint64_t)ceil(p / 100.0 * n);
+  for (size_t i = 0; i < HISTOGRAM_BUCKETS && n; i++) {
+    seen += atomic_load_explicit(&h->bucket[i], memory_order_relaxed);
+    if (seen >= rank)
+      return MIN(histogram_upper(i), max);
+  }
+  return max;
+}
+
+// OUTPUT ======================================================================
+
+void histogram_print(const histogram_t *h, const char *name, FILE *out) {
+  assert(h && name && out);
+  fprintf(out,
+          "%s: %llu samples, mean %.1f us, p50 %.1f us, p99 %.1f us, "
+          "p99.9 %.1f us, max %.1f us\n",
+          name, (unsigned long long)histogram_count(h),
+          histogram_mean(h) / 1e3, histogram_percentile(h, 50) / 1e3,
+          histogram_percentile(h, 99) / 1e3,
+          histogram_percentile(h, 99.9) / 1e3, histogram_max(h) / 1e3);
+}
+
+int histogram_write(const histogram_t *h, const char *name, FILE *out) {
+  assert(h && name && out);
+  uint64_t c;
+  for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    if (!(c = atomic_load_explicit(&h->bucket[i], memory_order_relaxed)))
+      continue;
+    if (fprintf(out, "%s, %llu, %llu, %llu\n", name,
+                (unsigned long long)histogram_lower(i),
+                (unsigned long long)histogram_upper(i),
+                (unsigned long long)c) < 0)
+      return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+
+
+//   ____  _        _   _         __
+//  / ___|| |_ __ _| |_(_) ___   / _|_   _ _ __   ___
+//  \___ \| __/ _` | __| |/ __| | |_| | | | '_ \ / __|
+//   ___) | || (_| | |_| | (__  |  _| |_| | | | | (__
+//  |____/ \__\__,_|\__|_|\___| |_|  \__,_|_| |_|\___|
+// Definitions for the static functions declared above
+
+// Bucket of a value: the exponent (position of the highest bit) selects
+// the power of two, the following HISTOGRAM_SUB_BITS bits the bucket in it
+static size_t histogram_bucket(uint64_t value) {
+  int e;
+  if (value < HISTOGRAM_LINEAR)
+    return (size_t)value;
+  e = 63 - __builtin_clzll(value);
+  return HISTOGRAM_LINEAR + (e - 4) * HISTOGRAM_SUB +
+         ((value >> (e - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB - 1));
+}
+
+// Smallest value of bucket i
+static uint64_t histogram_lower(size_t i) {
+  size_t e, sub;
+  if (i < HISTOGRAM_LINEAR)
+    return i;
+  e = (i - HISTOGRAM_LINEAR) / HISTOGRAM_SUB + 4;
+  sub = (i - HISTOGRAM_LINEAR) % HISTOGRAM_SUB;
+  return (uint64_t)(HISTOGRAM_SUB + sub) << (e - HISTOGRAM_SUB_BITS);
+}
+
+// Largest value of bucket i
+static uint64_t histogram_upper(size_t i) {
+  if (i + 1 == HISTOGRAM_BUCKETS)
+    return UINT64_MAX;
+  return histogram_lower(i + 1) - 1;
+}
+
+
+
+//   _____ _____ ____ _____   __  __       _
+//  |_   _| ____/ ___|_   _| |  \/  | __ _(_)_ __
+//    | | |  _| \___ \ | |   | |\/| |/ _` | | '_ \
+//    | | | |___ ___) || |   | |  | | (_| | | | | |
+//    |_| |_____|____/ |_|   |_|  |_|\__,_|_|_| |_|
+// Only needed for testing purpose. To enable, compile as:
+// clang src/histogram.c -o histogram -lm -DHISTOGRAM_MAIN
+#ifdef HISTOGRAM_MAIN
+#define N 1000000
+
+int main() {
+  histogram_t *h = histogram_new();
+  uint64_t v, exact, got;
+  size_t i, bad = 0;
+  int e, rv = 0;
+  double p[] = {50, 90, 99, 99.9, 100};
+
+  // bucket bounds: contiguous, and every bucket maps back to itself
+  for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    if (histogram_bucket(histogram_lower(i)) != i ||
+        histogram_bucket(histogram_upper(i)) != i ||
+        (i + 1 < HISTOGRAM_BUCKETS &&
+         histogram_upper(i) + 1 != histogram_lower(i + 1)))
+      bad++;
+  }
+  // values around each power of two fall within their bucket bounds
+  for (e = 0; e < 64; e++) {
+    for (v = (1ULL << e) - 1; v <= (1ULL << e) + 1; v++) {
+      i = histogram_bucket(v);
+      if (i >= HISTOGRAM_BUCKETS || v < histogram_lower(i) ||
+          v > histogram_upper(i))
+        bad++;
+    }
+  }
+  bad += histogram_bucket(UINT64_MAX) != HISTOGRAM_BUCKETS - 1;
+  printf("Bucket bounds: %zu errors: %s\n", bad, bad ? "FAILED" : "OK");
+  rv += bad > 0;
+
+  // percentiles of 1..N: the exact value, at most one bucket (12.5%) above
+  for (v = 1; v <= N; v++)
+    histogram_record(h, v);
+  rv += histogram_count(h) != N || histogram_max(h) != N ||
+        histogram_mean(h) != (N + 1) / 2.0;
+  for (i = 0; i < sizeof(p) / sizeof(p[0]); i++) {
+    exact = (uint64_t)ceil(p[i] / 100.0 * N);
+    got = histogram_percentile(h, p[i]);
+    printf("p%-4g exact %7llu, histogram %7llu (+%.1f%%)\n", p[i],
+           (unsigned long long)exact, (unsigned long long)got,
+           (got - (double)exact) / exact * 100);
+    rv += got < exact || got > exact + exact / HISTOGRAM_SUB;
+  }
+  histogram_reset(h);
+  rv += histogram_count(h) != 0 || histogram_percentile(h, 50) != 0;
+  printf("Percentiles: %s\n", rv ? "FAILED" : "OK");
+  histogram_free(h);
+  return rv;
+}
+#endif
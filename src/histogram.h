@@ -0,0 +1,65 @@
+//   _   _ _     _
+//  | | | (_)___| |_ ___   __ _ _ __ __ _ _ __ ___
+//  | |_| | / __| __/ _ \ / _` | '__/ _` | '_ ` _ \
+//  |  _  | \__ \ || (_) | (_| | | | (_| | | | | | |
+//  |_| |_|_|___/\__\___/ \__, |_|  \__,_|_| |_| |_|
+//                        |___/
+//  Lock-free histograms of durations
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include "defines.h"
+
+//   _____
+//  |_   _|   _ _ __   ___  ___
+//    | || | | | '_ \ / _ \/ __|
+//    | || |_| | |_) |  __/\__ \
+//    |_| \__, | .__/ \___||___/
+//        |___/|_|
+
+// Opaque structure: counts of values (e.g. durations in ns) in logarithmic
+// buckets. Values below 16 have a bucket each; above, every power of two is
+// split in 8 buckets, so that a bucket is at most 12.5% wide. Recording is
+// wait-free and allocates nothing: it can be done from a real-time loop,
+// while other threads read the histogram
+typedef struct histogram histogram_t;
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+histogram_t *histogram_new(void);
+void histogram_free(histogram_t *h);
+// Forget all the values (not to be called while recording)
+void histogram_reset(histogram_t *h);
+
+// RECORDING ===================================================================
+
+void histogram_record(histogram_t *h, uint64_t value);
+
+// STATISTICS ==================================================================
+
+uint64_t histogram_count(const histogram_t *h);
+uint64_t histogram_max(const histogram_t *h);
+double histogram_mean(const histogram_t *h);
+// Value not exceeded by p percent of the values (0 < p <= 100), as the upper
+// bound of its bucket (but at most the max)
+uint64_t histogram_percentile(const histogram_t *h, double p);
+
+// OUTPUT ======================================================================
+
+// Print a line with count, mean, p50, p99, p99.9 and max, taking the values
+// as nanoseconds and printing microseconds
+void histogram_print(const histogram_t *h, const char *name, FILE *out);
+// Write the non-empty buckets as CSV lines (with no header): name, lower and
+// upper bound, count
+int histogram_write(const histogram_t *h, const char *name, FILE *out);
+
+
+#endif // HISTOGRAM_H
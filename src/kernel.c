@@ -0,0 +1,361 @@
+//   _  __                    _
+//  | |/ /___ _ __ _ __   ___| |
+//  | ' // _ \ '__| '_ \ / _ \ |
+//  | . \  __/ |  | | | |  __/ |
+//  |_|\_\___|_|  |_| |_|\___|_|
+
+#include "kernel.h"
+#include <stdatomic.h>
+
+// The SIMD kernels are written once with the GCC/clang vector extensions,
+// on vectors of 4 doubles: the compiler maps them on SSE2 (two registers),
+// AVX2 (one register, in the functions compiled for it) or NEON (two
+// registers). Other compilers and targets (e.g. ARMv7, whose NEON has no
+// doubles) use the scalar kernels.
+#if defined(__GNUC__) && defined(__x86_64__)
+#define KERNEL_X86 1
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define KERNEL_ARM64 1
+#endif
+
+//   ____            _                 _   _
+//  |  _ \  ___  ___| | __ _ _ __ __ _| |_(_) ___  _ __  ___
+//  | | | |/ _ \/ __| |/ _` | '__/ _` | __| |/ _ \| '_ \/ __|
+//  | |_| |  __/ (__| | (_| | | | (_| | |_| | (_) | | | \__ \
+//  |____/ \___|\___|_|\__,_|_|  \__,_|\__|_|\___/|_| |_|___/
+
+// isa forced by kernel_set_isa, or -1 for the best one
+static atomic_int kernel_forced = -1;
+
+// STATIC FUNCTIONS (for internal use only) ====================================
+static kernel_isa_t kernel_best(void);
+static void line_scalar(size_t n, const data_t *lambda, data_t x0,
+                        data_t dx, data_t *out);
+static void arc_scalar(size_t n, const data_t *lambda, data_t cx, data_t cy,
+                       data_t r, data_t theta0, data_t dtheta, data_t *x,
+                       data_t *y);
+
+#if defined(KERNEL_X86) || defined(KERNEL_ARM64)
+#define KERNEL_SIMD 1
+#define W 4
+typedef double v4d __attribute__((vector_size(W * sizeof(double))));
+typedef uint64_t v4u __attribute__((vector_size(W * sizeof(uint64_t))));
+// helpers are always inlined, so that they are compiled for the instruction
+// set of the caller; vectors are passed by pointer, for the ABI of vectors
+// passed by value depends on the instruction set
+#define KERNEL_INLINE static inline __attribute__((always_inline))
+
+// Range reduction: x = k * PI/2 + y, with |y| <= PI/4. PI/2 is split in two
+// parts (Cody-Waite), the first one having enough trailing zeros for k*PIO2_1
+// to be exact
+#define PIO2_1 1.57079632673412561417e+00
+#define PIO2_1T 6.07710050650619224932e-11
+// adding and subtracting 1.5*2^52 rounds to the nearest integer
+#define ROUND_MAGIC 0x1.8p52
+// minimax polynomials on [-PI/4, PI/4] (from fdlibm)
+#define S1 -1.66666666666666324348e-01
+#define S2 8.33333333332248946124e-03
+#define S3 -1.98412698298579493134e-04
+#define S4 2.75573137070700676789e-06
+#define S5 -2.50507602534068634195e-08
+#define S6 1.58969099521155010221e-10
+#define C1 4.16666666666666019037e-02
+#define C2 -1.38888888888741095749e-03
+#define C3 2.48015872894767294178e-05
+#define C4 -2.75573143513906633035e-07
+#define C5 2.08757232129817482790e-09
+#define C6 -1.13596475577881948265e-11
+#endif
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// INSTRUCTION SET =============================================================
+
+kernel_isa_t kernel_isa(void) {
+  int forced = atomic_load_explicit(&kernel_forced, memory_order_relaxed);
+  return forced < 0 ? kernel_best() : (kernel_isa_t)forced;
+}
+
+const char *kernel_isa_name(kernel_isa_t isa) {
+  switch (isa) {
+  case KERNEL_SSE2: return "sse2";
+  case KERNEL_AVX2: return "avx2";
+  case KERNEL_NEON: return "neon";
+  default: return "scalar";
+  }
+}
+
+void kernel_set_isa(kernel_isa_t isa) {
+  kernel_isa_t best = kernel_best();
+  int ok = isa == KERNEL_SCALAR || isa == best ||
+           (isa == KERNEL_SSE2 && best == KERNEL_AVX2);
+  atomic_store(&kernel_forced, ok ? (int)isa : (int)KERNEL_SCALAR);
+}
+
+
+// SIMD KERNELS ================================================================
+#ifdef KERNEL_SIMD
+
+// sin and cos of the 4 angles in x
+KERNEL_INLINE void sincos4(const v4d *x, v4d *s, v4d *c) {
+  v4d t = *x * M_2_PI + ROUND_MAGIC;
+  v4d k = t - ROUND_MAGIC;
+  // the low bits of t hold k: its quadrant selects and signs the results
+  v4u q = (v4u)t & 3;
+  v4d y = (*x - k * PIO2_1) - k * PIO2_1T;
+  v4d z = y * y;
+  v4d ps = y + y * z * (S1 + z * (S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)))));
+  v4d pc = 1.0 - 0.5 * z +
+           z * z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6)))));
+  // quadrant | sin  | cos
+  //        0 |  ps  |  pc
+  //        1 |  pc  | -ps
+  //        2 | -ps  | -pc
+  //        3 | -pc  |  ps
+  v4u swap = (v4u)((q & 1) != 0);
+  v4u rs = (swap & (v4u)pc) | (~swap & (v4u)ps);
+  v4u rc = (swap & (v4u)ps) | (~swap & (v4u)pc);
+  rs ^= (q & 2) << 62;
+  rc ^= ((q + 1) & 2) << 62;
+  *s = (v4d)rs;
+  *c = (v4d)rc;
+}
+
+// out = x0 + dx * lambda
+KERNEL_INLINE void line4(size_t n, const data_t *lambda, data_t x0,
+                         data_t dx, data_t *out) {
+  size_t i;
+  v4d l, v;
+  for (i = 0; i + W <= n; i += W) {
+    memcpy(&l, lambda + i, sizeof(l));
+    v = x0 + dx * l;
+    memcpy(out + i, &v, sizeof(v));
+  }
+  for (; i < n; i++)
+    out[i] = x0 + dx * lambda[i];
+}
+
+// x = cx + r cos(theta), y = cy + r sin(theta)
+KERNEL_INLINE void arc4(size_t n, const data_t *lambda, data_t cx, data_t cy,
+                        data_t r, data_t theta0, data_t dtheta, data_t *x,
+                        data_t *y) {
+  size_t i, m;
+  v4d l, theta, s, c, v;
+  for (i = 0; i < n; i += W) {
+    m = MIN(W, n - i);
+    // the tail is padded, so that all samples get the same results
+    if (m < W)
+      memset(&l, 0, sizeof(l));
+    memcpy(&l, lambda + i, m * sizeof(data_t));
+    theta = theta0 + dtheta * l;
+    sincos4(&theta, &s, &c);
+    if (x) {
+      v = cx + r * c;
+      memcpy(x + i, &v, m * sizeof(data_t));
+    }
+    if (y) {
+      v = cy + r * s;
+      memcpy(y + i, &v, m * sizeof(data_t));
+    }
+  }
+}
+
+#ifdef KERNEL_X86
+// AVX2 versions: same code, compiled for AVX2 and FMA
+__attribute__((target("avx2,fma")))
+static void line_avx2(size_t n, const data_t *lambda, data_t x0, data_t dx,
+                      data_t *out) {
+  line4(n, lambda, x0, dx, out);
+}
+
+__attribute__((target("avx2,fma")))
+static void arc_avx2(size_t n, const data_t *lambda, data_t cx, data_t cy,
+                     data_t r, data_t theta0, data_t dtheta, data_t *x,
+                     data_t *y) {
+  arc4(n, lambda, cx, cy, r, theta0, dtheta, x, y);
+}
+#endif
+
+#endif // KERNEL_SIMD
+
+
+// DISPATCH ====================================================================
+
+void kernel_line(size_t n, const data_t *lambda, data_t x0, data_t dx,
+                 data_t *out) {
+  assert(lambda && out);
+  switch (kernel_isa()) {
+#ifdef KERNEL_X86
+  case KERNEL_AVX2:
+    line_avx2(n, lambda, x0, dx, out);
+    break;
+#endif
+#ifdef KERNEL_SIMD
+  case KERNEL_SSE2:
+  case KERNEL_NEON:
+    line4(n, lambda, x0, dx, out);
+    break;
+#endif
+  default:
+    line_scalar(n, lambda, x0, dx, out);
+    break;
+  }
+}
+
+void kernel_arc(size_t n, const data_t *lambda, data_t cx, data_t cy,
+                data_t r, data_t theta0, data_t dtheta, data_t *x,
+                data_t *y) {
+  assert(lambda);
+  switch (kernel_isa()) {
+#ifdef KERNEL_X86
+  case KERNEL_AVX2:
+    arc_avx2(n, lambda, cx, cy, r, theta0, dtheta, x, y);
+    break;
+#endif
+#ifdef KERNEL_SIMD
+  case KERNEL_SSE2:
+  case KERNEL_NEON:
+    arc4(n, lambda, cx, cy, r, theta0, dtheta, x, y);
+    break;
+#endif
+  default:
+    arc_scalar(n, lambda, cx, cy, r, theta0, dtheta, x, y);
+    break;
+  }
+}
+
+
+// ACCURACY ====================================================================
+
+// Compare kernel_arc against libm on n random lambdas of random arcs
+data_t kernel_arc_check(size_t n, data_t r) {
+  data_t *l = malloc(n * sizeof(data_t));
+  data_t *x = malloc(n * sizeof(data_t));
+  data_t *y = malloc(n * sizeof(data_t));
+  data_t err = 0, theta0, dtheta;
+  unsigned int seed = 1;
+  size_t i;
+  if (!l || !x || !y) {
+    perror("Could not allocate check buffers");
+    err = NAN;
+    goto end;
+  }
+  for (i = 0; i < n; i++)
+    l[i] = (data_t)rand_r(&seed) / RAND_MAX;
+  // arcs are defined in block_arc with theta0 in [-PI, PI] and dtheta
+  // in [-2PI, 2PI]
+  theta0 = -M_PI + 2 * M_PI * rand_r(&seed) / RAND_MAX;
+  dtheta = -2 * M_PI + 4 * M_PI * rand_r(&seed) / RAND_MAX;
+  kernel_arc(n, l, 0, 0, r, theta0, dtheta, x, y);
+  for (i = 0; i < n; i++) {
+    data_t theta = theta0 + dtheta * l[i];
+    err = MAX(err, hypot(x[i] - r * cos(theta), y[i] - r * sin(theta)));
+  }
+end:
+  free(l);
+  free(x);
+  free(y);
+  return err;
+}
+
+
+
+//   ____  _        _   _         __
+//  / ___|| |_ __ _| |_(_) ___   / _|_   _ _ __   ___
+//  \___ \| __/ _` | __| |/ __| | |_| | | | '_ \ / __|
+//   ___) | || (_| | |_| | (__  |  _| |_| | | | | (__
+//  |____/ \__\__,_|\__|_|\___| |_|  \__,_|_| |_|\___|
+// Definitions for the static functions declared above
+
+// Best instruction set supported by the CPU
+static kernel_isa_t kernel_best(void) {
+#if defined(KERNEL_X86)
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return KERNEL_AVX2;
+  return KERNEL_SSE2;
+#elif defined(KERNEL_ARM64)
+  return KERNEL_NEON;
+#else
+  return KERNEL_SCALAR;
+#endif
+}
+
+static void line_scalar(size_t n, const data_t *lambda, data_t x0,
+                        data_t dx, data_t *out) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = x0 + dx * lambda[i];
+}
+
+static void arc_scalar(size_t n, const data_t *lambda, data_t cx, data_t cy,
+                       data_t r, data_t theta0, data_t dtheta, data_t *x,
+                       data_t *y) {
+  for (size_t i = 0; i < n; i++) {
+    data_t theta = theta0 + dtheta * lambda[i];
+    if (x) x[i] = cx + r * cos(theta);
+    if (y) y[i] = cy + r * sin(theta);
+  }
+}
+
+
+
+//   _____ _____ ____ _____   __  __       _
+//  |_   _| ____/ ___|_   _| |  \/  | __ _(_)_ __
+//    | | |  _| \___ \ | |   | |\/| |/ _` | | '_ \
+//    | | | |___ ___) || |   | |  | | (_| | | | | |
+//    |_| |_____|____/ |_|   |_|  |_|\__,_|_|_| |_|
+// Only needed for testing purpose. To enable, compile as:
+// clang src/kernel.c -o kernel -lm -DKERNEL_MAIN
+#ifdef KERNEL_MAIN
+#include <time.h>
+#define N 1000000
+#define ERROR 0.005 // default machine_error
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main() {
+  kernel_isa_t isa, best = kernel_isa();
+  static data_t l[N], x[N], y[N];
+  data_t r;
+  int rv = 0;
+
+  printf("Best instruction set: %s\n", kernel_isa_name(best));
+  // accuracy, on every instruction set available
+  for (isa = KERNEL_SCALAR; isa <= KERNEL_NEON; isa++) {
+    kernel_set_isa(isa);
+    if (kernel_isa() != isa)
+      continue;
+    for (r = 1; r <= 1e6; r *= 100) {
+      data_t err = kernel_arc_check(N, r);
+      printf("%-6s r = %7.0e: max error %.3e mm (%s machine_error)\n",
+             kernel_isa_name(isa), r, err, err < ERROR ? "within" : "ABOVE");
+      rv += !(err < ERROR);
+    }
+  }
+  // speed (buffers are written once before, so that page faults are not
+  // accounted for)
+  for (size_t i = 0; i < N; i++)
+    l[i] = x[i] = y[i] = (data_t)i / N;
+  for (isa = KERNEL_SCALAR; isa <= KERNEL_NEON; isa++) {
+    kernel_set_isa(isa);
+    if (kernel_isa() != isa)
+      continue;
+    double t0 = now();
+    kernel_arc(N, l, 0, 0, 10, 0.1, 2, x, y);
+    double t1 = now();
+    kernel_line(N, l, 0, 10, x);
+    double t2 = now();
+    printf("%-6s arc %.2f ns/sample, line %.2f ns/sample\n",
+           kernel_isa_name(isa), (t1 - t0) * 1e9 / N, (t2 - t1) * 1e9 / N);
+  }
+  return rv;
+}
+#endif
@@ -0,0 +1,65 @@
+//   _  __                    _
+//  | |/ /___ _ __ _ __   ___| |
+//  | ' // _ \ '__| '_ \ / _ \ |
+//  | . \  __/ |  | | | |  __/ |
+//  |_|\_\___|_|  |_| |_|\___|_|
+//  Vectorized interpolation kernels
+
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include "defines.h"
+
+//   _____
+//  |_   _|   _ _ __   ___  ___
+//    | || | | | '_ \ / _ \/ __|
+//    | || |_| | |_) |  __/\__ \
+//    |_| \__, | .__/ \___||___/
+//        |___/|_|
+
+// Instruction sets the kernels can run on
+typedef enum {
+  KERNEL_SCALAR = 0, // plain C and libm
+  KERNEL_SSE2,       // x86, 2 doubles per instruction
+  KERNEL_AVX2,       // x86 with AVX2 and FMA, 4 doubles per instruction
+  KERNEL_NEON        // aarch64, 2 doubles per instruction
+} kernel_isa_t;
+
+// Upper bound of the absolute error of the vectorized sin/cos, for angles
+// within +/-KERNEL_MAX_ANGLE: an arc of radius r is interpolated within
+// r * KERNEL_SINCOS_ERROR of the libm result
+#define KERNEL_SINCOS_ERROR 1e-15
+#define KERNEL_MAX_ANGLE 1e3
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// Instruction set in use: the best one supported by the CPU, unless lowered
+// by kernel_set_isa
+kernel_isa_t kernel_isa(void);
+const char *kernel_isa_name(kernel_isa_t isa);
+
+// Use isa rather than the best one, e.g. for testing and benchmarking (an
+// isa not supported by the CPU falls back to KERNEL_SCALAR). Thread safe
+void kernel_set_isa(kernel_isa_t isa);
+
+// Line: out[i] = x0 + dx * lambda[i]
+void kernel_line(size_t n, const data_t *lambda, data_t x0, data_t dx,
+                 data_t *out);
+
+// Arc on the XY plane, with theta = theta0 + dtheta * lambda[i]:
+// x[i] = cx + r * cos(theta), y[i] = cy + r * sin(theta)
+// Angles must be within +/-KERNEL_MAX_ANGLE
+void kernel_arc(size_t n, const data_t *lambda, data_t cx, data_t cy,
+                data_t r, data_t theta0, data_t dtheta, data_t *x,
+                data_t *y);
+
+// Max distance between kernel_arc and libm on n random samples of an arc
+// of radius r: to be compared with machine_error
+data_t kernel_arc_check(size_t n, data_t r);
+
+#endif // KERNEL_H
@@ -0,0 +1,190 @@
+//   _
+//  | |    _____  _____ _ __
+//  | |   / _ \ \/ / _ \ '__|
+//  | |__|  __/>  <  __/ |
+//  |_____\___/_/\_\___|_|
+
+#include "lexer.h"
+#include <ctype.h>
+
+//   ____            _                 _   _
+//  |  _ \  ___  ___| | __ _ _ __ __ _| |_(_) ___  _ __  ___
+//  | | | |/ _ \/ __| |/ _` | '__/ _` | __| |/ _ \| '_ \/ __|
+//  | |_| |  __/ (__| | (_| | | | (_| | |_| | (_) | | | \__ \
+//  |____/ \___|\___|_|\__,_|_|  \__,_|\__|_|\___/|_| |_|___/
+
+// Up to this many digits the mantissa (< 2^53) and the power of ten are both
+// exact doubles, so that a single division gives a correctly rounded result
+#define FAST_DIGITS 15
+// Any 19-digit mantissa fits a uint64_t; further digits are below the
+// precision of a double anyway
+#define MAX_DIGITS 19
+
+static const data_t pow10_tab[FAST_DIGITS + 1] = {
+  1e0, 1e1, 1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+  1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+};
+
+#define IS_BLANK(c) ((c) == ' ' || (c) == '\t' || (c) == '\r')
+#define IS_DIGIT(c) ((c) >= '0' && (c) <= '9')
+
+static data_t pow10_of(int n);
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+word_status_t lexer_next(const char **cursor, word_t *w) {
+  assert(cursor && *cursor && w);
+  const char *c = *cursor;
+
+  while (IS_BLANK(*c))
+    c++;
+  if (*c == '\0' || *c == '\n') {
+    *cursor = c;
+    return WORD_END;
+  }
+  w->cmd = toupper((unsigned char)*c++);
+  // the argument must end where the next word (or the line) begins
+  if (!lexer_number(&c, &w->arg) ||
+      !(*c == '\0' || *c == '\n' || IS_BLANK(*c) || isalpha((unsigned char)*c))) {
+    // skip the rest of the malformed word
+    while (*c && *c != '\n' && !IS_BLANK(*c))
+      c++;
+    *cursor = c;
+    return WORD_ERROR;
+  }
+  *cursor = c;
+  return WORD_OK;
+}
+
+int lexer_number(const char **cursor, data_t *val) {
+  assert(cursor && *cursor && val);
+  const char *c = *cursor;
+  uint64_t m = 0;
+  int digits = 0, sig = 0, scale = 0, neg = 0;
+
+  if (*c == '-' || *c == '+')
+    neg = (*c++ == '-');
+  // only the first MAX_DIGITS significant digits go into the mantissa:
+  // further integer digits scale it up, further decimals are dropped
+  for (; IS_DIGIT(*c); c++, digits++) {
+    if (sig < MAX_DIGITS) {
+      m = m * 10 + (*c - '0');
+      sig += (m > 0);
+    }
+    else
+      scale++;
+  }
+  if (*c == '.') {
+    for (c++; IS_DIGIT(*c); c++, digits++) {
+      if (sig < MAX_DIGITS) {
+        m = m * 10 + (*c - '0');
+        sig += (m > 0);
+        scale--;
+      }
+    }
+  }
+  if (digits == 0)
+    return 0;
+  if (scale >= 0)
+    *val = (data_t)m * pow10_of(scale);
+  else
+    *val = (data_t)m / pow10_of(-scale);
+  if (neg)
+    *val = -*val;
+  *cursor = c;
+  return 1;
+}
+
+
+//   ____  _        _   _         __
+//  / ___|| |_ __ _| |_(_) ___   / _|_   _ _ __   ___
+//  \___ \| __/ _` | __| |/ __| | |_| | | | '_ \ / __|
+//   ___) | || (_| | |_| | (__  |  _| |_| | | | | (__
+//  |____/ \__\__,_|\__|_|\___| |_|  \__,_|_| |_|\___|
+// Definitions for the static functions declared above
+
+// Power of ten, from the table for the common short numbers
+static data_t pow10_of(int n) {
+  return n <= FAST_DIGITS ? pow10_tab[n] : pow(10, n);
+}
+
+
+
+
+//   _____ _____ ____ _____   __  __       _
+//  |_   _| ____/ ___|_   _| |  \/  | __ _(_)_ __
+//    | | |  _| \___ \ | |   | |\/| |/ _` | | '_ \
+//    | | | |___ ___) || |   | |  | | (_| | | | | |
+//    |_| |_____|____/ |_|   |_|  |_|\__,_|_|_| |_|
+// Throughput comparison against the former strsep/atof tokenizer. To enable,
+// compile as:
+// clang src/lexer.c -o lexer -lm -DLEXER_MAIN
+// and run as: ./lexer file.gcode
+#ifdef LEXER_MAIN
+#include <time.h>
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1.0E9;
+}
+
+int main(int argc, char const *argv[]) {
+  FILE *f;
+  char **lines = NULL, *line = NULL;
+  size_t n = 0, len = 0, i;
+  ssize_t l;
+  double t0, sum_old = 0, sum_new = 0, dt_old, dt_new;
+
+  if (argc != 2 || !(f = fopen(argv[1], "r"))) {
+    fprintf(stderr, "Usage: %s file.gcode\n", argv[0]);
+    return 1;
+  }
+  while ((l = getline(&line, &len, f)) >= 0) {
+    if (line[l - 1] == '\n')
+      line[l - 1] = '\0';
+    lines = realloc(lines, (n + 1) * sizeof(char *));
+    lines[n++] = strdup(line);
+  }
+  fclose(f);
+  free(line);
+
+  // former implementation: copy, strsep, atof
+  t0 = now();
+  for (i = 0; i < n; i++) {
+    char *word, *tok, *tofree;
+    tofree = tok = strdup(lines[i]);
+    while ((word = strsep(&tok, " ")) != NULL)
+      sum_old += atof(word + 1);
+    free(tofree);
+  }
+  dt_old = now() - t0;
+
+  // lexer
+  t0 = now();
+  for (i = 0; i < n; i++) {
+    const char *c = lines[i];
+    word_t w;
+    word_status_t s;
+    while ((s = lexer_next(&c, &w)) != WORD_END)
+      if (s == WORD_OK)
+        sum_new += w.arg;
+  }
+  dt_new = now() - t0;
+
+  printf("lines:  %zu\n", n);
+  printf("strsep: %.3e lines/s (checksum %f)\n", n / dt_old, sum_old);
+  printf("lexer:  %.3e lines/s (checksum %f)\n", n / dt_new, sum_new);
+  printf("speedup: %.2fx\n", dt_old / dt_new);
+
+  for (i = 0; i < n; i++)
+    free(lines[i]);
+  free(lines);
+  return 0;
+}
+#endif
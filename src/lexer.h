@@ -0,0 +1,52 @@
+//   _
+//  | |    _____  _____ _ __
+//  | |   / _ \ \/ / _ \ '__|
+//  | |__|  __/>  <  __/ |
+//  |_____\___/_/\_\___|_|
+//  G-code lexer
+
+#ifndef LEXER_H
+#define LEXER_H
+
+#include "defines.h"
+
+//   _____                      
+//  |_   _|   _ _ __   ___  ___ 
+//    | || | | | '_ \ / _ \/ __|
+//    | || |_| | |_) |  __/\__ \
+//    |_| \__, | .__/ \___||___/
+//        |___/|_|              
+
+// A G-code word: a command letter followed by its numeric argument
+typedef struct {
+  char cmd;   // command letter (always uppercase)
+  data_t arg; // numeric argument
+} word_t;
+
+// Outcome of scanning a word
+typedef enum {
+  WORD_END = 0, // no more words in the line
+  WORD_OK,      // a word has been scanned
+  WORD_ERROR    // malformed word (missing or invalid argument)
+} word_status_t;
+
+
+//   _____                 _   _                 
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___ 
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// Scan the next word of a line, starting at *cursor, and advance the cursor
+// past it. Words may be separated by any number of spaces, tabs or CRs, or
+// not separated at all (as in "G01X10Y20"). Nothing is allocated, and the
+// line is never modified.
+word_status_t lexer_next(const char **cursor, word_t *w);
+
+// Parse a decimal number (optional sign, no exponent) starting at *cursor
+// and advance the cursor past it. Unlike atof(), this does not depend on
+// the current locale. Returns 1 on success, 0 if there are no digits.
+int lexer_number(const char **cursor, data_t *val);
+
+
+#endif // LEXER_H
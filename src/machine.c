@@ -14,9 +14,14 @@
 //  |____/ \___|\___|_|\__,_|_|  \__,_|\__|_|\___/|_| |_|___/
                                                           
 
+// Default rapid feedrate (mm/min)
+#define RAPID_FEED 10000
+
 typedef struct machine {
   data_t A, tq, error;
-  point_t *zero, *offset;
+  data_t J;     // max jerk, 0 for trapezoidal profiles
+  data_t rapid; // rapid feedrate, for time estimates
+  point_t zero, offset;
 } machine_t;
 
 
@@ -50,13 +55,16 @@ machine_t *machine_new(const char *ini_path) {
     rc += ini_get_double(ini, "C-CNC", "origin_x", &x);
     rc += ini_get_double(ini, "C-CNC", "origin_y", &y);
     rc += ini_get_double(ini, "C-CNC", "origin_z", &z);
-    m->zero = point_new();
-    point_set_xyz(m->zero, x, y, z);
+    m->zero = point_v(x, y, z);
     rc += ini_get_double(ini, "C-CNC", "offset_x", &x);
     rc += ini_get_double(ini, "C-CNC", "offset_y", &y);
     rc += ini_get_double(ini, "C-CNC", "offset_z", &z);
-    m->offset = point_new();
-    point_set_xyz(m->offset, x, y, z);
+    m->offset = point_v(x, y, z);
+    // optional: without a max jerk, velocity profiles are trapezoidal
+    if (ini_get_double(ini, "C-CNC", "J", &m->J))
+      m->J = 0;
+    if (ini_get_double(ini, "C-CNC", "rapid", &m->rapid))
+      m->rapid = RAPID_FEED;
     ini_free(ini);
     if (rc > 0) {
       fprintf(stderr, "Missing/wrong %d config parameters\n", rc);
@@ -67,18 +75,16 @@ machine_t *machine_new(const char *ini_path) {
     m->A = 125;
     m->error = 0.005;
     m->tq = 0.005;
-    m->zero = point_new();
-    point_set_xyz(m->zero, 0, 0, 0);
-    m->offset = point_new();
-    point_set_xyz(m->offset, 0, 0, 0);
+    m->J = 0;
+    m->rapid = RAPID_FEED;
+    m->zero = point_v(0, 0, 0);
+    m->offset = point_v(0, 0, 0);
   }
   return m;
 }
 
 void machine_free(machine_t *m) {
   assert(m);
-  point_free(m->zero);
-  point_free(m->offset);
   free(m);
   m = NULL;
 }
@@ -92,6 +98,14 @@ typ machine_##par(const machine_t *m) { assert(m); return m->par; }
 machine_getter(data_t, A);
 machine_getter(data_t, tq);
 machine_getter(data_t, error);
-machine_getter(point_t *, zero);
-machine_getter(point_t *, offset);
+machine_getter(data_t, J);
+machine_getter(data_t, rapid);
+
+// points are embedded in the machine: these getters return their address
+#define machine_point_getter(par) \
+const point_t *machine_##par(const machine_t *m) { \
+  assert(m); return &m->par; }
+
+machine_point_getter(zero);
+machine_point_getter(offset);
 
@@ -18,7 +18,8 @@
 //    |_| \__, | .__/ \___||___/
 //        |___/|_|              
 
-// Opaque struct
+// Opaque struct. A machine is never modified after machine_new: it can be
+// shared by any number of threads (e.g. see executor_simulate_many)
 typedef struct machine machine_t;
 
 //   _____                 _   _                 
@@ -39,12 +40,20 @@ data_t machine_A(const machine_t *m);
 
 data_t machine_tq(const machine_t *m);
 
-point_t *machine_zero(const machine_t *m);
+const point_t *machine_zero(const machine_t *m);
 
-point_t *machine_offset(const machine_t *m);
+const point_t *machine_offset(const machine_t *m);
 
 data_t machine_error(const machine_t *m);
 
+// Max jerk (mm/s^3): if greater than 0, velocity profiles are jerk-limited
+// S-curves rather than trapezoids
+data_t machine_J(const machine_t *m);
+
+// Feedrate of rapid motions (mm/min): G00 blocks are not interpolated, this
+// is only used for estimating their time (see program_estimate)
+data_t machine_rapid(const machine_t *m);
+
 
 
 
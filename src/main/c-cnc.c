@@ -1,20 +1,456 @@
+//    ____       ____ _   _  ____
+//   / ___|     / ___| \ | |/ ___|
+//  | |   _____| |   |  \| | |
+//  | |__|_____| |___| |\  | |___
+//   \____|     \____|_| \_|\____|
+// C-CNC executable
+// Commands:
+// - render: parse and plan a G-code program, then sample it every tq into a
+//   binary trajectory file (see trajectory.h)
+// - play: map a trajectory file and play back its setpoints, printing a
+//   table of them; nothing is computed but the output
+// - estimate: print the machining time of G-code programs as CSV; each
+//   directory given is searched (not recursively) for G-code files, and
+//   all the programs are estimated in parallel
+// - run: parse and plan a G-code program, then execute it in real time,
+//   printing a setpoint every tq (see executor.h), and the statistics of
+//   the loop timing at the end; with --simulate, the same setpoints are
+//   computed on a virtual clock, as fast as possible, for checking programs
+// - verify: simulate G-code programs (as run --simulate), printing the
+//   cycle time and the errors of each one as CSV; the cycle time is the
+//   simulated time plus the G00 time, estimated as by estimate (G00 blocks
+//   are not sampled); directories are searched as by estimate, and all the
+//   programs are simulated in parallel
+
+// local includes
 #include "../defines.h"
+#include "../executor.h"
 #include "../machine.h"
 #include "../program.h"
-#include "../block.c"
-#include "../point.c"
+#include "../trajectory.h"
+
+// system includes
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// preprocessor macros and constants
+#define INI_FILE "settings.ini"
+// Periods kept in the trace of run -T (at 5 ms, about one hour and a half)
+#define TRACE_PERIODS (1 << 20)
+
+// Column names of the trajectory fields, in layout order
+static const char *field_names[TRAJ_FIELDS] = {"t", "n", "lambda", "feed",
+                                               "x", "y", "z"};
 
-int main(int argc, char const *argv[]) {
-  machine_t *machine = machine_new("settings.ini");
-  if (!machine) {
-    fprintf(stderr, "Error creating machine instance\n");
-    exit(EXIT_FAILURE);
+// Long options (all of them have a short form too)
+static const struct option long_options[] = {
+    {"simulate", no_argument, NULL, 'S'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}};
+
+static void usage(const char *name) {
+  fprintf(stderr,
+    "Usage: %s [options] render PROGRAM.gcode TRAJECTORY\n"
+    "       %s [options] play TRAJECTORY\n"
+    "       %s [options] estimate PROGRAM.gcode|DIRECTORY...\n"
+    "       %s [options] run PROGRAM.gcode\n"
+    "       %s [options] verify PROGRAM.gcode|DIRECTORY...\n"
+    "  -c FILE     machine settings (default %s)\n"
+    "  -l BLOCKS   planner look-ahead window (default 0, disabled)\n"
+    "  -j THREADS  parsing (estimating, verifying) threads, 0 for one per\n"
+    "              CPU (default 1 for render, 0 for estimate and verify)\n"
+    "  -a          render all the fields, including time and lambda\n"
+    "  -s          merge collinear G01 blocks\n"
+    "  -r          replace runs of G01 blocks with arcs\n"
+    "              (-s and -r apply to render, run and verify)\n"
+    "  -p          parse and plan in a pipeline of threads, while rendering\n"
+    "              or running (-j, -s and -r are not used)\n"
+    "  -K          keep the parsed programs in a .ccncb cache file next to\n"
+    "              them, and reuse it while the program and the machine\n"
+    "              settings do not change (not used with -p)\n"
+    "  -P PRIORITY run with SCHED_FIFO priority (1 to 99)\n"
+    "  -C CPU      run pinned to a CPU\n"
+    "  -m          run with locked memory\n"
+    "  -B SIZE     run with a planner thread, SIZE setpoints ahead\n"
+    "  -T FILE     write the loop periods of run as CSV (n, dt)\n"
+    "  -H FILE     write the loop timing histograms of run as CSV\n"
+    "  -S, --simulate\n"
+    "              run on a virtual clock, as fast as possible, and print\n"
+    "              the simulated time against the wall time\n",
+    name, name, name, name, name, INI_FILE);
+}
+
+// Parse and plan a program (or, with LOAD_PIPELINE, start doing so); NULL on
+// errors
+static program_t *load(machine_t *cfg, const char *gcode, program_load_t how,
+                       size_t lookahead, size_t threads, int simplify,
+                       int cache) {
+  program_t *p = program_new(gcode);
+  if (!p)
+    return NULL;
+  program_set_load(p, how);
+  program_set_threads(p, threads);
+  program_set_lookahead(p, lookahead);
+  program_set_simplify(p, simplify);
+  program_set_cache(p, cache);
+  if (program_parse(p, cfg) != EXIT_SUCCESS) {
+    program_free(p);
+    return NULL;
   }
+  return p;
+}
 
-  // TODO: create some blocks of G-code, and for a line or arc move
-  // make a loop stepping in time with the given sampling time and
-  // print out a table of time, lambda, feedrate, x, y, z
+// Parse and plan a program, then write its trajectory
+static int render(machine_t *cfg, const char *gcode, const char *path,
+                  program_load_t how, size_t lookahead, size_t threads,
+                  int simplify, int cache, unsigned int layout) {
+  program_t *p = load(cfg, gcode, how, lookahead, threads, simplify, cache);
+  int rv;
+  if (!p)
+    return EXIT_FAILURE;
+  rv = trajectory_render(p, cfg, path, layout);
+  program_free(p);
+  return rv;
+}
+
+// Print a setpoint, as a line of the play table (same format, so that the
+// two outputs can be compared byte by byte)
+static void print_setpoint(const executor_setpoint_t *sp, void *data) {
+  fprintf((FILE *)data, "%.6f %.6f %.6f %.6f %.6f %.6f %.6f\n", sp->t,
+          (data_t)sp->n, sp->lambda, sp->feed, sp->x, sp->y, sp->z);
+}
 
-  machine_free(machine);
+// Write a CSV file with write, NULL for no file
+static int write_csv(const char *path, executor_t *e,
+                     int (*write)(executor_t *, FILE *)) {
+  FILE *f;
+  int rv;
+  if (!path)
+    return EXIT_SUCCESS;
+  if (!(f = fopen(path, "w"))) {
+    perror(path);
+    return EXIT_FAILURE;
+  }
+  rv = write(e, f);
+  if (fclose(f))
+    rv = EXIT_FAILURE;
+  return rv;
+}
+
+static int write_trace(executor_t *e, FILE *f) {
+  return executor_write_trace(e, f);
+}
+
+static int write_histograms(executor_t *e, FILE *f) {
+  if (fprintf(f, "histogram, lower_ns, upper_ns, count\n") < 0 ||
+      histogram_write(executor_latency(e), "latency", f) ||
+      histogram_write(executor_busy(e), "busy", f))
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
+
+// Parse and plan a program, then execute it in real time
+static int run(executor_t *e, machine_t *cfg, const char *gcode,
+               program_load_t how, size_t lookahead, size_t threads,
+               int simplify, int cache, int simulate, const char *trace,
+               const char *histograms) {
+  program_t *p = load(cfg, gcode, how, lookahead, threads, simplify, cache);
+  struct timespec t0, t1;
+  double wall;
+  int rv;
+  if (!p)
+    return EXIT_FAILURE;
+  if (trace && executor_set_trace(e, TRACE_PERIODS)) {
+    program_free(p);
+    return EXIT_FAILURE;
+  }
+  printf("t n lambda feed x y z\n");
+  executor_set_output(e, print_setpoint, stdout);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  rv = executor_run(e, p);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  if (simulate) {
+    fprintf(stderr, "%zu setpoints, %.3f s simulated in %.3f s (%.0fx)\n",
+            executor_cycles(e), executor_elapsed(e), wall,
+            wall > 0 ? executor_elapsed(e) / wall : 0);
+  }
+  else {
+    fprintf(stderr, "%zu setpoints, %zu overruns", executor_cycles(e),
+            executor_overruns(e));
+    if (executor_high_water(e))
+      fprintf(stderr, ", %zu underruns, %zu setpoints ahead at most",
+              executor_underruns(e), executor_high_water(e));
+    fprintf(stderr, "\n");
+    histogram_print(executor_latency(e), "latency", stderr);
+    histogram_print(executor_busy(e), "busy", stderr);
+  }
+  if (write_csv(trace, e, write_trace) ||
+      write_csv(histograms, e, write_histograms))
+    rv = EXIT_FAILURE;
+  program_free(p);
+  return rv;
+}
+
+// Print all the setpoints of a trajectory file
+static int play(const char *path) {
+  trajectory_t *t = trajectory_open(path);
+  unsigned int layout;
+  size_t i, j, w;
+  if (!t)
+    return EXIT_FAILURE;
+  layout = trajectory_layout(t);
+  w = trajectory_width(t);
+  for (i = 0, j = 0; i < TRAJ_FIELDS; i++) {
+    if (layout & (1u << i))
+      printf("%s%s", j++ ? " " : "", field_names[i]);
+  }
+  printf("\n");
+  for (i = 0; i < trajectory_count(t); i++) {
+    const data_t *r = trajectory_record(t, i);
+    for (j = 0; j < w; j++)
+      printf("%s%.6f", j ? " " : "", r[j]);
+    printf("\n");
+  }
+  trajectory_free(t);
+  return EXIT_SUCCESS;
+}
+
+// True for the file names with a G-code extension
+static int is_gcode(const char *name) {
+  static const char *ext[] = {".gcode", ".g", ".nc", ".ngc"};
+  const char *dot = strrchr(name, '.');
+  if (!dot || dot == name)
+    return 0;
+  for (size_t i = 0; i < sizeof(ext) / sizeof(*ext); i++) {
+    if (!strcasecmp(dot, ext[i]))
+      return 1;
+  }
   return 0;
 }
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Append path to the list of files; directories are replaced by the G-code
+// files they contain, in alphabetical order
+static int add_path(const char *path, char ***files, size_t *n) {
+  struct stat st;
+  struct dirent *e;
+  DIR *dir;
+  char **list, *file;
+  size_t first = *n;
+  if (stat(path, &st)) {
+    perror(path);
+    return EXIT_FAILURE;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    if (!(list = realloc(*files, (*n + 1) * sizeof(char *))) ||
+        !(list[*n] = strdup(path)))
+      return EXIT_FAILURE;
+    *files = list;
+    (*n)++;
+    return EXIT_SUCCESS;
+  }
+  if (!(dir = opendir(path))) {
+    perror(path);
+    return EXIT_FAILURE;
+  }
+  while ((e = readdir(dir))) {
+    if (e->d_name[0] == '.' || !is_gcode(e->d_name))
+      continue;
+    if (asprintf(&file, "%s/%s", path, e->d_name) == -1)
+      break;
+    if (stat(file, &st) || !S_ISREG(st.st_mode) ||
+        !(list = realloc(*files, (*n + 1) * sizeof(char *)))) {
+      free(file);
+      continue;
+    }
+    list[(*n)++] = file;
+    *files = list;
+  }
+  closedir(dir);
+  if (*n > first)
+    qsort(*files + first, *n - first, sizeof(char *), compare_names);
+  return EXIT_SUCCESS;
+}
+
+// Estimate all the programs in paths, printing a CSV line for each
+static int estimate(machine_t *cfg, char *const paths[], size_t npaths,
+                    size_t lookahead, int cache, size_t threads) {
+  program_estimate_t *est;
+  char **files = NULL;
+  size_t i, t, n = 0, failures;
+  for (i = 0; i < npaths; i++) {
+    if (add_path(paths[i], &files, &n))
+      return EXIT_FAILURE;
+  }
+  if (!(est = calloc(n ? n : 1, sizeof(program_estimate_t)))) {
+    perror("Could not allocate estimates");
+    return EXIT_FAILURE;
+  }
+  failures = program_estimate_many((const char *const *)files, n, cfg,
+                                   lookahead, cache, threads, est);
+  // tool times as T:seconds pairs, separated by semicolons
+  printf("program,blocks,total_s,feed_s,rapid_s,tools_s\n");
+  for (i = 0; i < n; i++) {
+    printf("%s,%zu,%.3f,%.3f,%.3f,", files[i], est[i].blocks, est[i].total,
+           est[i].feed, est[i].rapid);
+    for (t = 0; t < est[i].tools; t++) {
+      if (est[i].tool[t].time > 0)
+        printf("%zu:%.3f;", est[i].tool[t].number, est[i].tool[t].time);
+    }
+    printf("\n");
+    program_estimate_free(&est[i]);
+    free(files[i]);
+  }
+  free(est);
+  free(files);
+  if (failures)
+    fprintf(stderr, "ERROR: %zu programs could not be estimated\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Simulate all the programs in paths, printing a CSV line for each
+static int verify(machine_t *cfg, char *const paths[], size_t npaths,
+                  size_t lookahead, int simplify, int cache,
+                  size_t threads) {
+  executor_report_t *rep;
+  char **files = NULL;
+  size_t i, n = 0, failures;
+  for (i = 0; i < npaths; i++) {
+    if (add_path(paths[i], &files, &n))
+      return EXIT_FAILURE;
+  }
+  if (!(rep = calloc(n ? n : 1, sizeof(executor_report_t)))) {
+    perror("Could not allocate reports");
+    return EXIT_FAILURE;
+  }
+  failures = executor_simulate_many((const char *const *)files, n, cfg,
+                                    lookahead, simplify, cache, threads, rep);
+  printf("program,setpoints,time_s,parse_errors,arc_errors,status\n");
+  for (i = 0; i < n; i++) {
+    printf("%s,%zu,%.3f,%zu,%zu,%s\n", files[i], rep[i].setpoints,
+           rep[i].time, rep[i].errors.parse, rep[i].errors.arc,
+           rep[i].failed ? "failed" : "ok");
+    free(files[i]);
+  }
+  free(rep);
+  free(files);
+  if (failures)
+    fprintf(stderr, "ERROR: %zu programs failed verification\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+//   __  __       _
+//  |  \/  | __ _(_)_ __
+//  | |\/| |/ _` | | '_ \
+//  | |  | | (_| | | | | |
+//  |_|  |_|\__,_|_|_| |_|
+
+int main(int argc, char *const argv[]) {
+  const char *ini = INI_FILE, *trace = NULL, *histograms = NULL;
+  size_t lookahead = 0, threads = 1;
+  int threads_set = 0, simplify = 0, priority = 0, cpu = -1, lock = 0;
+  int simulate = 0, cache = 0;
+  size_t buffer = 0;
+  program_load_t how = LOAD_MMAP;
+  unsigned int layout = TRAJ_DEFAULT;
+  machine_t *machine;
+  executor_t *executor;
+  int opt, rv;
+
+  while ((opt = getopt_long(argc, argv, "c:l:j:asrpKP:C:mB:T:H:Sh",
+                            long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'c': ini = optarg; break;
+    case 'l': lookahead = strtoul(optarg, NULL, 10); break;
+    case 'j':
+      threads = strtoul(optarg, NULL, 10);
+      threads_set = 1;
+      break;
+    case 'a': layout = (1u << TRAJ_FIELDS) - 1; break;
+    case 's': simplify |= SIMPLIFY_LINES; break;
+    case 'r': simplify |= SIMPLIFY_ARCS; break;
+    case 'p': how = LOAD_PIPELINE; break;
+    case 'K': cache = 1; break;
+    case 'P': priority = atoi(optarg); break;
+    case 'C': cpu = atoi(optarg); break;
+    case 'm': lock = 1; break;
+    case 'B': buffer = strtoul(optarg, NULL, 10); break;
+    case 'T': trace = optarg; break;
+    case 'H': histograms = optarg; break;
+    case 'S': simulate = 1; break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  argc -= optind;
+  argv += optind;
+
+  if (argc == 3 && !strcmp(argv[0], "render")) {
+    if (!(machine = machine_new(ini))) {
+      fprintf(stderr, "Error creating machine instance\n");
+      exit(EXIT_FAILURE);
+    }
+    rv = render(machine, argv[1], argv[2], how, lookahead, threads, simplify,
+                cache, layout);
+    machine_free(machine);
+  }
+  else if (argc == 2 && !strcmp(argv[0], "play")) {
+    rv = play(argv[1]);
+  }
+  else if (argc >= 2 && !strcmp(argv[0], "estimate")) {
+    // estimates stream the program: there is no path to simplify
+    if (simplify) {
+      fprintf(stderr, "ERROR: -s and -r cannot be used with estimate\n");
+      usage(argv[-optind]);
+      return EXIT_FAILURE;
+    }
+    if (!(machine = machine_new(ini))) {
+      fprintf(stderr, "Error creating machine instance\n");
+      exit(EXIT_FAILURE);
+    }
+    rv = estimate(machine, argv + 1, argc - 1, lookahead, cache,
+                  threads_set ? threads : 0);
+    machine_free(machine);
+  }
+  else if (argc >= 2 && !strcmp(argv[0], "verify")) {
+    if (!(machine = machine_new(ini))) {
+      fprintf(stderr, "Error creating machine instance\n");
+      exit(EXIT_FAILURE);
+    }
+    rv = verify(machine, argv + 1, argc - 1, lookahead, simplify, cache,
+                threads_set ? threads : 0);
+    machine_free(machine);
+  }
+  else if (argc == 2 && !strcmp(argv[0], "run")) {
+    if (!(machine = machine_new(ini))) {
+      fprintf(stderr, "Error creating machine instance\n");
+      exit(EXIT_FAILURE);
+    }
+    if (!(executor = executor_new(machine))) {
+      machine_free(machine);
+      exit(EXIT_FAILURE);
+    }
+    executor_set_priority(executor, priority);
+    executor_set_cpu(executor, cpu);
+    executor_set_lock(executor, lock);
+    executor_set_buffer(executor, buffer);
+    executor_set_simulate(executor, simulate);
+    rv = run(executor, machine, argv[1], how, lookahead, threads, simplify,
+             cache, simulate, trace, histograms);
+    executor_free(executor);
+    machine_free(machine);
+  }
+  else {
+    usage(argv[-optind]);
+    rv = EXIT_FAILURE;
+  }
+  return rv;
+}
@@ -0,0 +1,569 @@
+//   _                     _
+//  | |__   ___ _ __   ___| |__
+//  | '_ \ / _ \ '_ \ / __| '_ \
+//  | |_) |  __/ | | | (__| | | |
+//  |_.__/ \___|_| |_|\___|_| |_|
+// Parser and planner benchmark
+// Generates synthetic G-code programs (G00/G01/G02/G03, with both R and IJ
+// arcs) of increasing size and measures the parsing and planning functions.
+// Results go to stdout (or appended to a file with -o) as CSV, one line per
+// benchmark and program size:
+//   version,build,benchmark,lines,ops,ns_op,allocs_op,peak_rss_kb
+// NOTES:
+// - allocs_op counts malloc/calloc/realloc calls (glibc only, -1 elsewhere)
+// - peak_rss_kb is the peak RSS of the process so far (it never decreases)
+// - block_render is per sample, like block_lambda and block_interpolate;
+//   block_render_scalar is the same without the vectorized kernels
+// - block_compute is static: it is measured through block_plan on G01
+//   blocks, which only adds the feed and acceleration assignment
+// - build in Release mode for meaningful timings
+
+// local includes
+#include "../defines.h"
+#include "../block.h"
+#include "../kernel.h"
+#include "../machine.h"
+#include "../program.h"
+
+// system includes
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+// preprocessor macros and constants
+#define MIN_LINES 1000
+#define MAX_LINES 1000000
+#define MAX_SAMPLES 1000000
+#define MIN_OPS 1000000 // repeat short benchmarks up to this many ops
+#define SEED 1
+#define TQ 0.005
+
+//   ____            _                 _   _
+//  |  _ \  ___  ___| | __ _ _ __ __ _| |_(_) ___  _ __  ___
+//  | | | |/ _ \/ __| |/ _` | '__/ _` | __| |/ _ \| '_ \/ __|
+//  | |_| |  __/ (__| | (_| | | | (_| | |_| | (_) | | | \__ \
+//  |____/ \___|\___|_|\__,_|_|  \__,_|\__|_|\___/|_| |_|___/
+
+// Result of a single benchmark
+typedef struct {
+  const char *name;
+  size_t lines;   // program size
+  size_t ops;     // number of operations measured
+  double ns;      // total time
+  long allocs;    // total allocations (-1 if not available)
+} bench_t;
+
+// Generated program, loaded in memory and split in lines
+typedef struct {
+  char *path;     // file on disk (for program_parse)
+  char *text;     // whole file content
+  char **lines;   // lines (in place, in text)
+  size_t n;       // number of lines
+} source_t;
+
+// Options
+static size_t min_lines = MIN_LINES, max_lines = MAX_LINES;
+static size_t max_samples = MAX_SAMPLES;
+static size_t threads = 0;
+static uint64_t seed = SEED;
+
+// Sink for the benchmark results, so that the calls are not optimized out
+static volatile data_t sink;
+
+//      _    _ _                 _   _
+//     / \  | | | ___   ___ __ _| |_(_) ___  _ __  ___
+//    / _ \ | | |/ _ \ / __/ _` | __| |/ _ \| '_ \/ __|
+//   / ___ \| | | (_) | (_| (_| | |_| | (_) | | | \__ \
+//  /_/   \_\_|_|\___/ \___\__,_|\__|_|\___/|_| |_|___/
+// Allocations are counted by interposing malloc and friends: the definitions
+// below take precedence over the libc ones also for the calls made within
+// the shared library. glibc exports the original implementations as
+// __libc_*, elsewhere the counter is not available.
+
+static atomic_long allocs = 0;
+
+#ifdef __GLIBC__
+#define HAVE_ALLOC_COUNT 1
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+  atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+  atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+#else
+#define HAVE_ALLOC_COUNT 0
+#endif
+
+static long alloc_count(void) {
+  return HAVE_ALLOC_COUNT ? atomic_load(&allocs) : -1;
+}
+
+// Time in ns from an arbitrary origin
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Peak RSS in kB
+static long peak_rss_kb(void) {
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru))
+    return -1;
+#ifdef __APPLE__
+  return ru.ru_maxrss / 1024; // bytes on macOS
+#else
+  return ru.ru_maxrss;
+#endif
+}
+
+//    ____                           _
+//   / ___| ___ _ __   ___ _ __ __ _| |_ ___  _ __
+//  | |  _ / _ \ '_ \ / _ \ '__/ _` | __/ _ \| '__|
+//  | |_| |  __/ | | |  __/ | | (_| | || (_) | |
+//   \____|\___|_| |_|\___|_|  \__,_|\__\___/|_|
+
+// xorshift64*: same sequence on every platform, unlike rand()
+static uint64_t rng_state;
+static double rng(void) {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return (double)((rng_state * 0x2545F4914F6CDD1DULL) >> 11) / (1ULL << 53);
+}
+static double uniform(double a, double b) { return a + (b - a) * rng(); }
+
+// Write a program of n lines, made of:
+// 10% G00, 55% G01, 20% G02/G03 with I,J, 15% G02/G03 with R
+// Arc feedrates stay below the centripetal limit of the default machine
+static void generate(FILE *out, size_t n, uint64_t s) {
+  static const int feeds[] = {500, 1000, 2000};
+  data_t x = 0, y = 0, z = 0;
+  rng_state = s ? s : SEED;
+  fprintf(out, "N1 G00 X0 Y0 Z0 T1 S1000\n");
+  for (size_t i = 2; i <= n; i++) {
+    double r = rng();
+    if (r < 0.10) { // rapid
+      x = uniform(0, 100);
+      y = uniform(0, 100);
+      z = uniform(0, 10);
+      fprintf(out, "N%zu G00 X%.3f Y%.3f Z%.3f\n", i, x, y, z);
+    }
+    else if (r < 0.65) { // line
+      x = uniform(0, 100);
+      y = uniform(0, 100);
+      fprintf(out, "N%zu G01 X%.3f Y%.3f F%d\n", i, x, y,
+              feeds[(int)(rng() * 3)]);
+    }
+    else if (r < 0.85) { // arc with I,J: the end point lies on the circle
+      int cw = rng() < 0.5;
+      data_t R = uniform(5, 20), a0 = uniform(0, 2 * M_PI);
+      data_t a1 = a0 + (cw ? -1 : 1) * uniform(0.2, 2);
+      data_t xc = x - R * cos(a0), yc = y - R * sin(a0);
+      data_t xf = xc + R * cos(a1), yf = yc + R * sin(a1);
+      fprintf(out, "N%zu G%02d X%.6f Y%.6f I%.6f J%.6f F%d\n", i,
+              cw ? 2 : 3, xf, yf, xc - x, yc - y, feeds[(int)(rng() * 2)]);
+      x = xf;
+      y = yf;
+    }
+    else { // arc with R: chord not horizontal, radius longer than chord/2
+      int cw = rng() < 0.5;
+      data_t c = uniform(1, 10), a = uniform(0.1, M_PI - 0.1);
+      data_t dx = c * cos(a), dy = c * sin(a) * (rng() < 0.5 ? -1 : 1);
+      data_t R = uniform(MAX(5, c / 2 * 1.1), 20);
+      x += dx;
+      y += dy;
+      fprintf(out, "N%zu G%02d X%.6f Y%.6f R%.3f F%d\n", i, cw ? 2 : 3, x, y,
+              R, feeds[(int)(rng() * 2)]);
+    }
+  }
+}
+
+// Generate a program in a temporary file and load it in memory
+static int source_new(source_t *src, size_t n) {
+  const char *dir = getenv("TMPDIR");
+  FILE *f;
+  long len;
+  memset(src, 0, sizeof(*src));
+  if (asprintf(&src->path, "%s/ccnc_bench_XXXXXX", dir ? dir : "/tmp") == -1)
+    return EXIT_FAILURE;
+  int fd = mkstemp(src->path);
+  if (fd < 0 || !(f = fdopen(fd, "w+"))) {
+    perror("Could not create program file");
+    return EXIT_FAILURE;
+  }
+  generate(f, n, seed);
+  len = ftell(f);
+  rewind(f);
+  src->text = malloc(len + 1);
+  src->lines = malloc(n * sizeof(char *));
+  if (!src->text || !src->lines || fread(src->text, 1, len, f) != (size_t)len) {
+    perror("Could not load program file");
+    fclose(f);
+    return EXIT_FAILURE;
+  }
+  fclose(f);
+  src->text[len] = '\0';
+  // split in place
+  for (char *p = src->text; *p && src->n < n; src->n++) {
+    src->lines[src->n] = p;
+    p = strchr(p, '\n');
+    *p++ = '\0';
+  }
+  return EXIT_SUCCESS;
+}
+
+static void source_free(source_t *src) {
+  unlink(src->path);
+  free(src->path);
+  free(src->text);
+  free(src->lines);
+}
+
+//   ____                  _                          _
+//  | __ )  ___ _ __   ___| |__  _ __ ___   __ _ _ __| | _____
+//  |  _ \ / _ \ '_ \ / __| '_ \| '_ ` _ \ / _` | '__| |/ / __|
+//  | |_) |  __/ | | | (__| | | | | | | | | (_| | |  |   <\__ \
+//  |____/ \___|_| |_|\___|_| |_|_| |_| |_|\__,_|_|  |_|\_\___/
+// Each benchmark fills in ops, ns and allocs of its result
+
+// number of repetitions needed for reaching MIN_OPS
+static size_t repetitions(size_t n) {
+  return n >= MIN_OPS ? 1 : MIN_OPS / n;
+}
+
+// program_new + program_parse + program_free, per line
+static int bench_program_parse(bench_t *r, const source_t *src,
+                               machine_t *cfg, program_load_t load,
+                               size_t nthreads) {
+  size_t reps = repetitions(src->n);
+  for (size_t k = 0; k < reps; k++) {
+    program_t *p = program_new(src->path);
+    if (!p)
+      return EXIT_FAILURE;
+    program_set_load(p, load);
+    program_set_threads(p, nthreads);
+    long a0 = alloc_count();
+    double t0 = now_ns();
+    int rv = program_parse(p, cfg);
+    r->ns += now_ns() - t0;
+    r->allocs += alloc_count() - a0;
+    r->ops += src->n;
+    program_free(p);
+    if (rv) {
+      fprintf(stderr, "ERROR: %d parsing errors\n", rv);
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// block_new + block_parse over in-memory lines, per block
+static int bench_block_parse(bench_t *r, const source_t *src,
+                             machine_t *cfg) {
+  size_t reps = repetitions(src->n);
+  for (size_t k = 0; k < reps; k++) {
+    block_t *b = NULL, *prev = NULL;
+    int rv = 0;
+    long a0 = alloc_count();
+    double t0 = now_ns();
+    for (size_t i = 0; i < src->n; i++) {
+      b = block_new_ref(src->lines[i], prev, cfg);
+      rv += block_parse(b);
+      if (prev && block_prev(prev))
+        block_free(block_prev(prev));
+      prev = b;
+    }
+    r->ns += now_ns() - t0;
+    r->allocs += alloc_count() - a0;
+    r->ops += src->n;
+    if (block_prev(b))
+      block_free(block_prev(b));
+    block_free(b);
+    if (rv) {
+      fprintf(stderr, "ERROR: %d parsing errors\n", rv);
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// block_plan (i.e. block_compute) on G01 blocks of a parsed program
+static void bench_block_compute(bench_t *r, program_t *p) {
+  size_t reps = repetitions(program_length(p));
+  for (size_t k = 0; k < reps; k++) {
+    block_t *b;
+    long a0 = alloc_count();
+    double t0 = now_ns();
+    program_reset(p);
+    while ((b = program_next(p))) {
+      if (block_type(b) != LINE)
+        continue;
+      block_plan(b);
+      r->ops++;
+    }
+    r->ns += now_ns() - t0;
+    r->allocs += alloc_count() - a0;
+  }
+}
+
+// Sampling functions, called every TQ on motion blocks
+typedef void (*sampler_t)(block_t *b, data_t t);
+
+static void sample_lambda(block_t *b, data_t t) {
+  data_t v;
+  sink = block_lambda(b, t, &v);
+}
+
+static void sample_interpolate(block_t *b, data_t t) {
+  point_t *pt = block_interpolate(b, t / block_dt(b));
+  sink = point_x(pt);
+  point_free(pt);
+}
+
+static void sample_interpolate_v(block_t *b, data_t t) {
+  sink = block_interpolate_v(b, t / block_dt(b)).x;
+}
+
+// Sample motion blocks every TQ, up to max_samples in total
+static void bench_sample(bench_t *r, program_t *p, sampler_t f) {
+  block_t *b;
+  long a0 = alloc_count();
+  double t0 = now_ns();
+  program_reset(p);
+  while ((b = program_next(p)) && r->ops < max_samples) {
+    if (block_type(b) != LINE && block_type(b) != ARC_CW &&
+        block_type(b) != ARC_CCW)
+      continue;
+    data_t dt = block_dt(b);
+    for (data_t t = 0; t <= dt && r->ops < max_samples; t += TQ) {
+      f(b, t);
+      r->ops++;
+    }
+  }
+  r->ns += now_ns() - t0;
+  r->allocs += alloc_count() - a0;
+}
+
+// Same as bench_sample with block_lambda, through a block_sampler_t
+static void bench_block_sampler(bench_t *r, program_t *p) {
+  block_t *b;
+  block_sampler_t s;
+  data_t v;
+  long a0 = alloc_count();
+  double t0 = now_ns();
+  program_reset(p);
+  while ((b = program_next(p)) && r->ops < max_samples) {
+    if (block_type(b) != LINE && block_type(b) != ARC_CW &&
+        block_type(b) != ARC_CCW)
+      continue;
+    data_t dt = block_dt(b);
+    block_sampler_init(&s, b, 0);
+    for (data_t t = 0; t <= dt && r->ops < max_samples; t += TQ) {
+      sink = block_sampler_next(&s, &v);
+      r->ops++;
+    }
+  }
+  r->ns += now_ns() - t0;
+  r->allocs += alloc_count() - a0;
+}
+
+// block_render on motion blocks, up to max_samples in total, per sample
+#define RENDER_BUFFER 1024
+static void bench_render(bench_t *r, program_t *p) {
+  static data_t t[RENDER_BUFFER], l[RENDER_BUFFER], f[RENDER_BUFFER];
+  static data_t x[RENDER_BUFFER], y[RENDER_BUFFER], z[RENDER_BUFFER];
+  block_trajectory_t out = {t, l, f, x, y, z};
+  block_t *b;
+  data_t t0 = 0;
+  size_t k, n;
+  long a0 = alloc_count();
+  double t_0 = now_ns();
+  program_reset(p);
+  while ((b = program_next(p)) && r->ops < max_samples) {
+    for (k = 0; r->ops < max_samples; k += n) {
+      n = block_render(b, t0, k, MIN(RENDER_BUFFER, max_samples - r->ops),
+                       &out);
+      if (n == 0)
+        break;
+      sink = x[n - 1];
+      r->ops += n;
+    }
+    t0 = block_carry(b, t0);
+  }
+  r->ns += now_ns() - t_0;
+  r->allocs += alloc_count() - a0;
+}
+#undef RENDER_BUFFER
+
+// Print a result as a CSV line
+static void report(FILE *out, const bench_t *r) {
+  size_t ops = r->ops ? r->ops : 1;
+  fprintf(out, "%s,%s,%s,%zu,%zu,%.2f,%.3f,%ld\n", VERSION, BUILD_TYPE,
+          r->name, r->lines, r->ops, r->ns / ops,
+          r->allocs < 0 ? -1.0 : (double)r->allocs / ops, peak_rss_kb());
+  fflush(out);
+}
+
+// Run all the benchmarks on a program of n lines
+static int bench_all(FILE *out, machine_t *cfg, size_t n) {
+  source_t src;
+  program_t *p;
+  int rv = EXIT_SUCCESS;
+  kernel_isa_t isa;
+  bench_t r;
+
+  if (source_new(&src, n)) {
+    source_free(&src);
+    return EXIT_FAILURE;
+  }
+
+  // Macro for resetting the result, running a benchmark and reporting it
+#define BENCH(label, call)                                                  \
+  do {                                                                      \
+    memset(&r, 0, sizeof(r));                                               \
+    r.name = label;                                                         \
+    r.lines = n;                                                            \
+    if (!HAVE_ALLOC_COUNT)                                                  \
+      r.allocs = -1;                                                        \
+    fprintf(stderr, "%-28s %zu lines\n", label, n);                         \
+    call;                                                                   \
+    report(out, &r);                                                        \
+  } while (0)
+
+  BENCH("program_parse",
+        rv = bench_program_parse(&r, &src, cfg, LOAD_GETLINE, 1));
+  if (rv) goto end;
+  BENCH("program_parse_mmap",
+        rv = bench_program_parse(&r, &src, cfg, LOAD_MMAP, 1));
+  if (rv) goto end;
+  BENCH("program_parse_threads",
+        rv = bench_program_parse(&r, &src, cfg, LOAD_MMAP, threads));
+  if (rv) goto end;
+  BENCH("block_parse", rv = bench_block_parse(&r, &src, cfg));
+  if (rv) goto end;
+
+  // the remaining benchmarks work on a parsed program
+  p = program_new(src.path);
+  program_set_load(p, LOAD_MMAP);
+  if (program_parse(p, cfg)) {
+    rv = EXIT_FAILURE;
+    program_free(p);
+    goto end;
+  }
+  BENCH("block_compute", bench_block_compute(&r, p));
+  BENCH("block_lambda", bench_sample(&r, p, sample_lambda));
+  BENCH("block_sampler", bench_block_sampler(&r, p));
+  BENCH("block_interpolate", bench_sample(&r, p, sample_interpolate));
+  BENCH("block_interpolate_v", bench_sample(&r, p, sample_interpolate_v));
+  BENCH("block_render", bench_render(&r, p));
+  // the same, with the vectorized kernels disabled
+  isa = kernel_isa();
+  kernel_set_isa(KERNEL_SCALAR);
+  BENCH("block_render_scalar", bench_render(&r, p));
+  kernel_set_isa(isa);
+  program_free(p);
+#undef BENCH
+
+end:
+  source_free(&src);
+  return rv;
+}
+
+//   __  __       _
+//  |  \/  | __ _(_)_ __
+//  | |\/| |/ _` | | '_ \
+//  | |  | | (_| | | | | |
+//  |_|  |_|\__,_|_|_| |_|
+
+static void usage(const char *name) {
+  fprintf(stderr,
+    "Usage: %s [options]\n"
+    "  -n LINES    smallest program size (default %d)\n"
+    "  -m LINES    largest program size (default %d, sizes grow by 10x)\n"
+    "  -S SAMPLES  max samples for block_lambda/interpolate (default %d)\n"
+    "  -j THREADS  threads for program_parse_threads (default: all CPUs)\n"
+    "  -s SEED     generator seed (default %d)\n"
+    "  -o FILE     append results to FILE rather than printing them\n"
+    "  -g FILE     only generate a program of -m lines into FILE (- for stdout)\n"
+    "  -c FILE     machine settings (default: built-in values)\n"
+    "Sizes can be given in exponential notation (e.g. -m 1e7)\n",
+    name, MIN_LINES, MAX_LINES, MAX_SAMPLES, SEED);
+}
+
+int main(int argc, char *const argv[]) {
+  const char *out_path = NULL, *gen_path = NULL, *ini_path = NULL;
+  FILE *out = stdout;
+  machine_t *cfg = NULL;
+  int opt, rv = EXIT_SUCCESS;
+
+  // command line parsing
+  while ((opt = getopt(argc, argv, "n:m:S:j:s:o:g:c:h")) != -1) {
+    switch (opt) {
+    case 'n': min_lines = (size_t)strtod(optarg, NULL); break;
+    case 'm': max_lines = (size_t)strtod(optarg, NULL); break;
+    case 'S': max_samples = (size_t)strtod(optarg, NULL); break;
+    case 'j': threads = (size_t)atol(optarg); break;
+    case 's': seed = (uint64_t)strtoull(optarg, NULL, 10); break;
+    case 'o': out_path = optarg; break;
+    case 'g': gen_path = optarg; break;
+    case 'c': ini_path = optarg; break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  // generation only
+  if (gen_path) {
+    FILE *f = strcmp(gen_path, "-") ? fopen(gen_path, "w") : stdout;
+    if (!f) {
+      perror("Could not open program file");
+      return EXIT_FAILURE;
+    }
+    generate(f, max_lines, seed);
+    if (f != stdout)
+      fclose(f);
+    return EXIT_SUCCESS;
+  }
+
+  if (min_lines < 2 || max_lines < min_lines) {
+    fprintf(stderr, "ERROR: wrong program sizes\n");
+    return EXIT_FAILURE;
+  }
+
+  // benchmarks use the default machine, unless an INI file is given (e.g.
+  // with a max jerk, for S-curve profiles)
+  if (!(cfg = machine_new(ini_path)))
+    return EXIT_FAILURE;
+  if (out_path) {
+    if (!(out = fopen(out_path, "a"))) {
+      perror("Could not open output file");
+      machine_free(cfg);
+      return EXIT_FAILURE;
+    }
+  }
+  // header on stdout and on new files
+  if (out == stdout || (fseek(out, 0, SEEK_END) == 0 && ftell(out) == 0))
+    fprintf(out, "version,build,benchmark,lines,ops,ns_op,allocs_op,"
+                 "peak_rss_kb\n");
+  for (size_t n = min_lines; n <= max_lines && !rv; n *= 10) {
+    rv = bench_all(out, cfg, n);
+  }
+  if (out != stdout)
+    fclose(out);
+  machine_free(cfg);
+  return rv;
+}
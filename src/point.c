@@ -6,32 +6,6 @@
 
 #include "point.h"
 
-//   ____            _                 _   _                 
-//  |  _ \  ___  ___| | __ _ _ __ __ _| |_(_) ___  _ __  ___ 
-//  | | | |/ _ \/ __| |/ _` | '__/ _` | __| |/ _ \| '_ \/ __|
-//  | |_| |  __/ (__| | (_| | | | (_| | |_| | (_) | | | \__ \
-//  |____/ \___|\___|_|\__,_|_|  \__,_|\__|_|\___/|_| |_|___/
-                                                          
-
-// Point object struct
-// We are using a bitmask for encoding the coordinates that are left
-// undefined.
-// 0000 0000 => none set (0)
-// 0000 0001 => x is set (1)
-// 0000 0010 => y is set (2)
-// 0000 0100 => z is set (3)
-// 0000 0111 => xyz set (7)
-typedef struct point {
-  data_t x, y, z;
-  uint8_t s;
-} point_t;
-
-// Mnemonics for bitmask settings
-#define X_SET '\1'
-#define Y_SET '\2'
-#define Z_SET '\4'
-#define ALL_SET '\7'
-
 //   _____                 _   _                 
 //  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___ 
 //  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
@@ -58,12 +32,10 @@ void point_free(point_t *p) {
   p = NULL;
 }
 
-// Write into desc a description of a point
-// desc is automatically allocated to the right size.
-// it is CALLER RESPONSIBILITY TO FREE desc
+// Write into buf a description of a point, with no allocations
 #define FIELD_LENGTH 8
-void point_inspect(const point_t *p, char **desc) {
-  assert(p);
+int point_format(const point_t *p, char *buf, size_t len) {
+  assert(p && (buf || !len));
   char str_x[FIELD_LENGTH+1], str_y[FIELD_LENGTH+1], str_z[FIELD_LENGTH+1];
   if (p->s & X_SET) { // defined
     snprintf(str_x, sizeof(str_x), "%*.3f", FIELD_LENGTH, p->x);
@@ -85,12 +57,22 @@ void point_inspect(const point_t *p, char **desc) {
   else { // not defined
     snprintf(str_z, sizeof(str_z), "%*s", FIELD_LENGTH, "-");
   }
-  if (asprintf(desc, "[%s %s %s]", str_x, str_y, str_z) == -1) {
+  return snprintf(buf, len, "[%s %s %s]", str_x, str_y, str_z);
+}
+#undef FIELD_LENGTH
+
+// Write into desc a description of a point
+// desc is automatically allocated to the right size.
+// it is CALLER RESPONSIBILITY TO FREE desc
+void point_inspect(const point_t *p, char **desc) {
+  assert(p && desc);
+  int len = point_format(p, NULL, 0);
+  if (len < 0 || !(*desc = malloc(len + 1))) {
     perror("Could not create point description string");
     exit(EXIT_FAILURE);
   }
+  point_format(p, *desc, len + 1);
 }
-#undef FIELD_LENGTH
 
 
 // ACCESSORS ===================================================================
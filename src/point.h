@@ -17,8 +17,28 @@
 //    |_| \__, | .__/ \___||___/
 //        |___/|_|              
 
-// Object class defined as an OPAQUE STRUCT
-typedef struct point point_t;
+// Point object struct
+// The struct is public, so that points can be used by value (i.e. embedded
+// in other objects, on the stack, in arrays) with no allocations at all.
+// The pointer-based API below still works on them, and point_new/point_free
+// are only needed for heap-allocated points.
+// We are using a bitmask for encoding the coordinates that are left
+// undefined.
+// 0000 0000 => none set (0)
+// 0000 0001 => x is set (1)
+// 0000 0010 => y is set (2)
+// 0000 0100 => z is set (3)
+// 0000 0111 => xyz set (7)
+typedef struct point {
+  data_t x, y, z;
+  uint8_t s;
+} point_t;
+
+// Mnemonics for bitmask settings
+#define X_SET '\1'
+#define Y_SET '\2'
+#define Z_SET '\4'
+#define ALL_SET '\7'
 
 
 //   _____                 _   _                 
@@ -40,6 +60,10 @@ void point_free(point_t *p);
 // when done!!!
 void point_inspect(const point_t *p, char **desc);
 
+// Same as point_inspect, but writes into buf (at most len chars, including
+// the terminator): no allocations. Returns the length of the description
+int point_format(const point_t *p, char *buf, size_t len);
+
 // ACCESSORS ===================================================================
 
 // Set coordinates
@@ -65,5 +89,62 @@ void point_delta(const point_t *from, const point_t *to, point_t *delta);
 // must be able ti inherit undefined coordinates from the previous point
 void point_modal(const point_t *from, point_t *to);
 
+// BY VALUE ====================================================================
+// Inline counterparts of the functions above, taking and returning points
+// by value
+
+// Point with all the coordinates set
+static inline point_t point_v(data_t x, data_t y, data_t z) {
+  return (point_t){x, y, z, ALL_SET};
+}
+
+// Point with no coordinates set
+static inline point_t point_none(void) {
+  return (point_t){0, 0, 0, 0};
+}
+
+// Coordinate flags
+static inline int point_has_x(point_t p) { return (p.s & X_SET) != 0; }
+static inline int point_has_y(point_t p) { return (p.s & Y_SET) != 0; }
+static inline int point_has_z(point_t p) { return (p.s & Z_SET) != 0; }
+
+// Copy of p with one coordinate set
+static inline point_t point_with_x(point_t p, data_t x) {
+  p.x = x;
+  p.s |= X_SET;
+  return p;
+}
+static inline point_t point_with_y(point_t p, data_t y) {
+  p.y = y;
+  p.s |= Y_SET;
+  return p;
+}
+static inline point_t point_with_z(point_t p, data_t z) {
+  p.z = z;
+  p.s |= Z_SET;
+  return p;
+}
+
+// Distance between two points
+static inline data_t point_dist_v(point_t from, point_t to) {
+  data_t dx = to.x - from.x, dy = to.y - from.y, dz = to.z - from.z;
+  return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+// Projections
+static inline point_t point_delta_v(point_t from, point_t to) {
+  return point_v(to.x - from.x, to.y - from.y, to.z - from.z);
+}
+
+// Modal behavior: to inherits the coordinates it has not set from from
+static inline point_t point_modal_v(point_t from, point_t to) {
+  uint8_t inherit = from.s & ~to.s;
+  if (inherit & X_SET) to.x = from.x;
+  if (inherit & Y_SET) to.y = from.y;
+  if (inherit & Z_SET) to.z = from.z;
+  to.s |= inherit;
+  return to;
+}
+
 
 #endif // POINT_H
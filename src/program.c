@@ -7,6 +7,16 @@
 // program.c
 
 #include "program.h"
+#include "compiled.h"
+#include "queue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 //   ____            _                 _   _                 
@@ -21,8 +31,129 @@ typedef struct program {
   FILE *file;                      // file handle
   block_t *first, *last, *current; // block pointers
   size_t n;                        // total number of blocks
+  program_load_t load;             // loading strategy
+  char *map;                       // mapped file content (LOAD_MMAP)
+  size_t map_len;                  // length of the mapping
+  size_t threads;                  // number of parsing threads
+  machine_t *cfg;                  // machine configuration (LOAD_STREAM)
+  char *line;                      // line buffer (LOAD_STREAM)
+  size_t line_size;                // size of the line buffer
+  size_t window;                   // blocks parsed ahead (LOAD_STREAM)
+  size_t pos;                      // number of blocks returned by next
+  int eof;                         // true when the file is exhausted
+  int failed;                      // true if program_next met an error
+  program_errors_t errors;         // errors found in the blocks
+  arena_t *arena;                  // memory of all blocks (not LOAD_STREAM)
+  int cache;                       // true to use the compiled cache file
+  size_t lookahead;                // blocks considered by the planner
+  int simplify;                    // path simplifications (or-ed)
+  struct program_pipeline *pipe;   // parse and plan stages (LOAD_PIPELINE)
 } program_t;
 
+// Header of the compiled cache file, followed by the compiled arrays (see
+// compiled.h) and by the NUL-terminated lines of all the blocks.
+// The cache is valid only if the G-code file content and all the machine
+// parameters that affect planning are the same.
+// WARNING: bump CACHE_VERSION on any change to the compiled arrays or to the
+// way blocks are planned
+#define CACHE_MAGIC "CCNCB\0\0"
+#define CACHE_VERSION 4
+#define CACHE_EXT ".ccncb"
+typedef struct {
+  char magic[8];          // CACHE_MAGIC
+  uint32_t version;       // CACHE_VERSION
+  uint16_t data_size;     // sizeof(data_t)
+  uint16_t size_size;     // sizeof(size_t)
+  uint64_t hash;          // hash of the G-code file content
+  uint64_t length;        // length of the G-code file
+  data_t A, tq, error, J; // machine parameters
+  data_t zero[3];         // machine zero
+  uint64_t lookahead;     // look-ahead window
+  uint64_t simplify;      // path simplifications
+  uint64_t n;             // number of blocks
+  uint64_t data_len;      // size of the compiled arrays
+  uint64_t lines_len;     // size of the lines
+} program_cache_t;
+
+// Max number of blocks merged into one by program_merge_blocks (the cost of
+// merging or fitting grows with the square of the run length)
+#define SIMPLIFY_MAX 256
+
+// Range of blocks processed by a single parsing thread
+typedef struct {
+  char **lines;     // all the lines of the program
+  const char *tail; // unterminated last line, to be copied (or NULL)
+  block_t **blocks; // all the blocks of the program
+  machine_t *cfg;   // machine configuration
+  arena_t *arena;   // arena for the blocks of this thread
+  size_t from, to;  // range [from, to) of blocks for this thread
+  int errors;       // number of errors found in the range
+  pthread_t tid;    // thread running the chunk
+  int running;      // true if tid has to be joined
+} program_chunk_t;
+
+// Programs shared by the threads of program_estimate_many: each thread
+// takes the next program not yet estimated
+typedef struct {
+  const char *const *files;   // program files
+  size_t n;                   // number of files
+  machine_t *cfg;             // machine configuration (read only)
+  size_t lookahead;           // look-ahead window of every program
+  int cache;                  // true to use the compiled cache
+  program_estimate_t *est;    // estimates, one per file
+  atomic_size_t next;         // next file to be estimated
+  atomic_size_t failures;     // number of failed estimates
+} program_batch_t;
+
+// Stages of LOAD_PIPELINE. Each stage only touches its own blocks: those it
+// has popped and not pushed yet. A block is linked to the next one by the
+// parse stage, so the plan stage follows the links only up to the last
+// block it popped, and program_next not at all
+typedef struct program_pipeline {
+  queue_t *parsed;       // blocks from the parse stage to the plan stage
+  queue_t *planned;      // blocks from the plan stage to program_next
+  block_t *first;        // first block created by the parse stage
+  atomic_int error;      // true once a stage has found errors
+  pthread_t parse, plan; // stage threads
+  int running;           // number of stage threads to be joined
+} program_pipeline_t;
+
+// STATIC FUNCTIONS (for internal use only) ====================================
+static int program_append(program_t *p, block_t *b, const char *line);
+static int program_parse_getline(program_t *p, machine_t *cfg);
+static int program_parse_mmap(program_t *p, machine_t *cfg);
+static int program_parse_stream(program_t *p, machine_t *cfg);
+static int program_read_block(program_t *p, machine_t *cfg);
+static int program_fill(program_t *p);
+static void program_release(program_t *p);
+static int program_parse_parallel(program_t *p, machine_t *cfg);
+static int program_map(program_t *p);
+static int program_cache_header(program_t *p, machine_t *cfg,
+                                program_cache_t *h);
+static int program_cache_load(program_t *p, machine_t *cfg,
+                              const program_cache_t *key);
+static int program_cache_save(program_t *p, machine_t *cfg,
+                              const program_cache_t *key);
+static uint64_t program_hash(const char *data, size_t len);
+static int program_run_chunks(program_t *p, program_chunk_t *proto, size_t n,
+                              void *(*work)(void *), size_t *errors);
+static void *program_scan_chunk(void *arg);
+static void *program_plan_chunk(void *arg);
+static void program_plan_speeds(program_t *p, block_t *b);
+static void program_merge_blocks(program_t *p, machine_t *cfg,
+                                 size_t (*merge)(block_t *, data_t, size_t));
+static int program_estimate_add(program_estimate_t *est, const block_t *b,
+                                machine_t *cfg);
+static int program_estimate_parsed(program_t *p, machine_t *cfg,
+                                   program_estimate_t *est);
+static void *program_estimate_worker(void *arg);
+static int program_pipeline_start(program_t *p);
+static void program_pipeline_stop(program_t *p);
+static block_t *program_pipeline_next(program_t *p);
+static void *program_parse_stage(void *arg);
+static void *program_plan_stage(void *arg);
+static int program_plan_send(program_t *p, block_t **oldest, size_t *held);
+
 
 //   _____                 _   _
 //  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
@@ -49,6 +180,23 @@ program_t *program_new(const char *filename) {
   p->last = NULL;
   p->current = NULL;
   p->n = 0;
+  p->load = LOAD_GETLINE;
+  p->map = NULL;
+  p->map_len = 0;
+  p->threads = 1;
+  p->cfg = NULL;
+  p->line = NULL;
+  p->line_size = 0;
+  p->window = 32;
+  p->pos = 0;
+  p->eof = 0;
+  p->failed = 0;
+  memset(&p->errors, 0, sizeof(p->errors));
+  p->arena = NULL;
+  p->cache = 0;
+  p->lookahead = 0;
+  p->simplify = 0;
+  p->pipe = NULL;
   return p;
 }
 
@@ -56,15 +204,28 @@ program_t *program_new(const char *filename) {
 void program_free(program_t *p) {
   assert(p);
   block_t *b, *tmp;
-  // free the linked list of blocks
-  if (p->n > 0) {
+  // the stages free the blocks they still hold
+  if (p->pipe)
+    program_pipeline_stop(p);
+  // free the blocks: all at once if they live in the arena, otherwise
+  // walking the linked list
+  if (p->arena) {
+    arena_free(p->arena);
+  }
+  else {
     b = p->first;
-    do {
+    while (b) {
       tmp = b;
       b = block_next(b);
       block_free(tmp);
-    } while (b);
+    }
   }
+  // blocks may refer to the mapping, so it goes away after them
+  if (p->map)
+    munmap(p->map, p->map_len);
+  if (p->load == LOAD_STREAM && p->file)
+    fclose(p->file);
+  free(p->line);
   free(p->filename);
   free(p);
   p = NULL;
@@ -83,63 +244,289 @@ void program_print(const program_t *p, FILE *output) {
 
 // PROCESSING ==================================================================
 
+// select the loading strategy
+void program_set_load(program_t *p, program_load_t load) {
+  assert(p);
+  p->load = load;
+}
+
+// set the number of blocks parsed ahead of the current one (LOAD_STREAM)
+void program_set_window(program_t *p, size_t window) {
+  assert(p);
+  p->window = MAX(window, 1);
+}
+
+// set the number of parsing threads (0 means one per online CPU)
+void program_set_threads(program_t *p, size_t threads) {
+  assert(p);
+  if (threads == 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = ncpu > 0 ? ncpu : 1;
+  }
+  p->threads = threads;
+}
+
+// enable or disable the compiled cache file
+void program_set_cache(program_t *p, int cache) {
+  assert(p);
+  p->cache = cache;
+}
+
+// set the look-ahead window of the planner (0 or 1 disables it)
+void program_set_lookahead(program_t *p, size_t blocks) {
+  assert(p);
+  p->lookahead = blocks;
+}
+
+void program_set_simplify(program_t *p, int simplify) {
+  assert(p);
+  p->simplify = simplify;
+}
+
 // parse the program
 // return either EXIT_SUCCESS or EXIT_FAILURE
 int program_parse(program_t *p, machine_t *cfg) {
   assert(p && cfg);
-  char *line = NULL;
-  ssize_t line_len = 0;
-  size_t n = 0;
-  block_t *b;
-
-  // open the file
-  p->file = fopen(p->filename, "r");
-  if (!p->file) {
-    fprintf(stderr, "ERROR: cannot open the file %s\n", p->filename);
+  program_cache_t key;
+  int rv, cache;
+  p->n = 0;
+  memset(&p->errors, 0, sizeof(p->errors));
+  if (p->load == LOAD_STREAM)
+    return program_parse_stream(p, cfg);
+  if (p->load == LOAD_PIPELINE) {
+    program_pipeline_stop(p);
+    p->cfg = cfg;
+    return program_pipeline_start(p);
+  }
+  // blocks stay around until program_free: allocate them in an arena
+  if (!p->arena && !(p->arena = arena_new(0)))
     return EXIT_FAILURE;
+  // a valid cache file spares the whole parsing
+  cache = p->cache && !program_cache_header(p, cfg, &key);
+  if (cache && !program_cache_load(p, cfg, &key)) {
+    program_reset(p);
+    return EXIT_SUCCESS;
   }
-
-  // read the file, one line at a time, and create a new block for
-  // each line
-  p->n = 0;
-  while ( (line_len = getline(&line, &n, p->file)) >= 0 ) {
-    // remove trailing newline (\n) replacing it with a terminator
-    if (line[line_len-1] == '\n') {
-      line[line_len-1] = '\0'; 
-    }
-    if(!(b = block_new(line, p->last, cfg))) {
-      fprintf(stderr, "ERROR: creating the block %s\n", line);
-      return EXIT_FAILURE;
-    }
-    if (block_parse(b)) {
-      fprintf(stderr, "ERROR: parsing the block %s\n", line);
-      return EXIT_FAILURE;
+  if (p->threads > 1 && p->load == LOAD_MMAP) {
+    rv = program_parse_parallel(p, cfg);
+  }
+  else {
+    switch (p->load) {
+    case LOAD_MMAP:
+      rv = program_parse_mmap(p, cfg);
+      break;
+    default:
+      rv = program_parse_getline(p, cfg);
+      break;
     }
-    if (p->first == NULL) p->first = b;
-    p->last = b;
-    p->n++;
   }
-  fclose(p->file);
-  free(line);
+  if (rv == EXIT_SUCCESS && (p->errors.parse || p->errors.arc))
+    rv = EXIT_FAILURE;
+  if (rv == EXIT_SUCCESS && (p->simplify & SIMPLIFY_ARCS))
+    program_merge_blocks(p, cfg, block_fit_arc);
+  if (rv == EXIT_SUCCESS && (p->simplify & SIMPLIFY_LINES))
+    program_merge_blocks(p, cfg, block_merge);
+  if (rv == EXIT_SUCCESS && p->lookahead > 1) {
+    block_t *b;
+    for (b = p->first; b; b = block_next(b))
+      program_plan_speeds(p, b);
+  }
+  if (rv == EXIT_SUCCESS && cache && program_cache_save(p, cfg, &key))
+    fprintf(stderr, "WARNING: could not write the cache of %s\n", p->filename);
   program_reset(p);
-  return EXIT_SUCCESS;
+  return rv;
 }
 
 // linked-list navigation functions
 block_t *program_next(program_t *p) {
   assert(p);
+  if (p->load == LOAD_PIPELINE)
+    return program_pipeline_next(p);
+  if (p->load == LOAD_STREAM) {
+    // once exhausted, the stream stays at its end until reset
+    if (p->current == NULL && p->pos > 0)
+      return NULL;
+    if (program_fill(p)) {
+      p->failed = 1;
+      return NULL;
+    }
+  }
   if (p->current == NULL) p->current = p->first;
   else p->current = block_next(p->current);
+  if (p->load == LOAD_STREAM) {
+    if (p->current) p->pos++;
+    program_release(p);
+    // only the blocks in the window are known: plan as they come
+    if (p->current && p->lookahead > 1)
+      program_plan_speeds(p, p->current);
+  }
   return p->current;
 }
 
 void program_reset(program_t *p) {
   assert(p);
+  // a pipeline that has been consumed has to be started again
+  if (p->load == LOAD_PIPELINE && p->pos > 0) {
+    program_pipeline_stop(p);
+    if (program_pipeline_start(p))
+      program_pipeline_stop(p);
+  }
+  // a stream that has been consumed has to be parsed again from the top
+  if (p->load == LOAD_STREAM && p->pos > 0) {
+    block_t *b = p->first, *tmp;
+    while (b) {
+      tmp = b;
+      b = block_next(b);
+      block_free(tmp);
+    }
+    p->first = p->last = NULL;
+    p->n = p->pos = 0;
+    p->eof = 0;
+    p->failed = 0;
+    memset(&p->errors, 0, sizeof(p->errors));
+    rewind(p->file);
+  }
   p->current = NULL;
 }
 
 
 
+// ESTIMATE ====================================================================
+
+int program_estimate(program_t *p, machine_t *cfg, program_estimate_t *est) {
+  assert(p && cfg && est);
+  // blocks are kept in a ring: the one being estimated, the lookahead - 1
+  // following ones, and the previous one (for its exit speed). Each block
+  // has its own line buffer, as the block refers to its line
+  size_t w = p->lookahead > 1 ? p->lookahead : 1, r = w + 1;
+  size_t head = 0, cur = 0, slot, k;
+  block_t **ring = NULL, *last = NULL;
+  char **lines = NULL;
+  size_t *sizes = NULL;
+  ssize_t len;
+  FILE *f;
+  int rv = EXIT_SUCCESS, eof = 0;
+
+  memset(est, 0, sizeof(*est));
+  if (p->cache)
+    return program_estimate_parsed(p, cfg, est);
+  if (!(f = fopen(p->filename, "r"))) {
+    perror("Could not open the program file");
+    return EXIT_FAILURE;
+  }
+  ring = (block_t **)calloc(r, sizeof(block_t *));
+  lines = (char **)calloc(r, sizeof(char *));
+  sizes = (size_t *)calloc(r, sizeof(size_t));
+  if (!ring || !lines || !sizes) {
+    perror("Could not allocate the estimate window");
+    rv = EXIT_FAILURE;
+    goto end;
+  }
+  for (;;) {
+    // parse ahead, recycling the oldest block of the ring
+    while (!eof && head < cur + w) {
+      slot = head % r;
+      if ((len = getline(&lines[slot], &sizes[slot], f)) < 0) {
+        eof = 1;
+        break;
+      }
+      if (len > 0 && lines[slot][len - 1] == '\n')
+        lines[slot][len - 1] = '\0';
+      if (ring[slot]) {
+        block_recycle(ring[slot], lines[slot], last);
+      }
+      else if (!(ring[slot] = block_new_ref(lines[slot], last, cfg))) {
+        fprintf(stderr, "ERROR: creating the block %s\n", lines[slot]);
+        rv = EXIT_FAILURE;
+        goto end;
+      }
+      last = ring[slot];
+      head++;
+      if (block_parse(last)) {
+        fprintf(stderr, "ERROR: parsing the block %s\n", lines[slot]);
+        rv = EXIT_FAILURE;
+        goto end;
+      }
+    }
+    if (cur == head)
+      break;
+    if (p->lookahead > 1)
+      program_plan_speeds(p, ring[cur % r]);
+    if (program_estimate_add(est, ring[cur % r], cfg)) {
+      rv = EXIT_FAILURE;
+      goto end;
+    }
+    cur++;
+  }
+
+end:
+  // oldest first: block_free touches the next block
+  for (k = head > r ? head - r : 0; ring && k < head; k++)
+    block_free(ring[k % r]);
+  for (k = 0; lines && k < r; k++)
+    free(lines[k]);
+  free(ring);
+  free(lines);
+  free(sizes);
+  fclose(f);
+  if (rv != EXIT_SUCCESS)
+    program_estimate_free(est);
+  return rv;
+}
+
+void program_estimate_free(program_estimate_t *est) {
+  assert(est);
+  free(est->tool);
+  memset(est, 0, sizeof(*est));
+}
+
+size_t program_estimate_many(const char *const *files, size_t n,
+                             machine_t *cfg, size_t lookahead, int cache,
+                             size_t threads, program_estimate_t *est) {
+  assert(files && cfg && est);
+  program_batch_t batch = {.files = files, .n = n, .cfg = cfg,
+                           .lookahead = lookahead, .cache = cache,
+                           .est = est};
+  pthread_t *tids;
+  int *running;
+  size_t i;
+
+  atomic_init(&batch.next, 0);
+  atomic_init(&batch.failures, 0);
+  if (threads == 0) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = ncpu > 0 ? ncpu : 1;
+  }
+  threads = MAX(MIN(threads, n), 1);
+  tids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+  running = (int *)calloc(threads, sizeof(int));
+  // the calling thread works as well; if no thread can be created, it does
+  // all the work
+  for (i = 1; tids && running && i < threads; i++)
+    running[i] = !pthread_create(&tids[i], NULL, program_estimate_worker,
+                                 &batch);
+  program_estimate_worker(&batch);
+  for (i = 1; tids && running && i < threads; i++) {
+    if (running[i])
+      pthread_join(tids[i], NULL);
+  }
+  free(tids);
+  free(running);
+  return atomic_load(&batch.failures);
+}
+
+// Trapezoidal profile at machine_rapid, or triangular if too short to reach it
+data_t program_rapid_time(const block_t *b, machine_t *cfg) {
+  assert(b && cfg);
+  data_t l = block_length(b), A = machine_A(cfg);
+  data_t f = machine_rapid(cfg) / 60.0; // mm/s
+  if (l >= f * f / A)
+    return l / f + f / A;
+  return 2 * sqrt(l / A);
+}
+
+
+
 // GETTERS =====================================================================
 
 #define program_getter(typ, par, name) \
@@ -150,6 +537,841 @@ program_getter(block_t *, first, first);
 program_getter(block_t *, current, current);
 program_getter(block_t *, last, last);
 program_getter(size_t, n, length);
+program_getter(program_load_t, load, load);
+program_getter(size_t, threads, threads);
+program_getter(size_t, window, window);
+program_getter(size_t, lookahead, lookahead);
+program_getter(int, simplify, simplify);
+program_getter(int, failed, failed);
+program_getter(program_errors_t, errors, errors);
+
+
+
+//   ____  _        _   _         __
+//  / ___|| |_ __ _| |_(_) ___   / _|_   _ _ __   ___
+//  \___ \| __/ _` | __| |/ __| | |_| | | | '_ \ / __|
+//   ___) | || (_| | |_| | (__  |  _| |_| | | | | (__
+//  |____/ \__\__,_|\__|_|\___| |_|  \__,_|_| |_|\___|
+// Definitions for the static functions declared above
+
+// Parse a freshly created block and append it to the list. A block with
+// errors is appended as well, and its errors are counted: the return value
+// is EXIT_FAILURE only if the block could not be created
+static int program_append(program_t *p, block_t *b, const char *line) {
+  int scan, plan;
+  if (!b) {
+    fprintf(stderr, "ERROR: creating the block %s\n", line);
+    return EXIT_FAILURE;
+  }
+  // same as block_parse, telling tokenizing errors from arc errors
+  scan = block_scan(b);
+  block_inherit(b, block_prev(b));
+  plan = block_plan(b);
+  if (scan || plan) {
+    fprintf(stderr, "ERROR: parsing the block %s\n", line);
+    p->errors.parse += scan > 0;
+    p->errors.arc += plan > 0;
+  }
+  if (p->first == NULL) p->first = b;
+  p->last = b;
+  p->n++;
+  return EXIT_SUCCESS;
+}
+
+// Read the file one line at a time, and create a new block for each line
+static int program_parse_getline(program_t *p, machine_t *cfg) {
+  int rv;
 
+  // open the file
+  p->file = fopen(p->filename, "r");
+  if (!p->file) {
+    fprintf(stderr, "ERROR: cannot open the file %s\n", p->filename);
+    return EXIT_FAILURE;
+  }
+  while ((rv = program_read_block(p, cfg)) > 0)
+    ;
+  fclose(p->file);
+  p->file = NULL;
+  free(p->line);
+  p->line = NULL;
+  p->line_size = 0;
+  return rv < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
+// Read one line from p->file and append the corresponding block. Return 1 if
+// a block has been appended (even with errors, see program_append), 0 at the
+// end of file, -1 if the block could not be created
+static int program_read_block(program_t *p, machine_t *cfg) {
+  block_t *b;
+  ssize_t line_len = getline(&p->line, &p->line_size, p->file);
+  if (line_len < 0)
+    return 0;
+  // remove trailing newline (\n) replacing it with a terminator
+  if (p->line[line_len-1] == '\n') {
+    p->line[line_len-1] = '\0'; 
+  }
+  if (p->arena) {
+    char *line = arena_strdup(p->arena, p->line);
+    b = line ? block_new_in(p->arena, line, p->last, cfg) : NULL;
+  }
+  else {
+    b = block_new(p->line, p->last, cfg);
+  }
+  if (program_append(p, b, p->line))
+    return -1;
+  return 1;
+}
 
+// Open the file and only parse the first window of blocks; the following
+// ones are parsed lazily by program_next
+static int program_parse_stream(program_t *p, machine_t *cfg) {
+  if (p->file)
+    fclose(p->file);
+  p->file = fopen(p->filename, "r");
+  if (!p->file) {
+    fprintf(stderr, "ERROR: cannot open the file %s\n", p->filename);
+    return EXIT_FAILURE;
+  }
+  p->cfg = cfg;
+  p->pos = 0;
+  p->eof = 0;
+  p->failed = 0;
+  memset(&p->errors, 0, sizeof(p->errors));
+  p->current = NULL;
+  return program_fill(p);
+}
+
+// Parse blocks until the window after the current block is full
+static int program_fill(program_t *p) {
+  int rv;
+  while (!p->eof && p->n - p->pos < p->window) {
+    // a stream stops at the first error
+    if ((rv = program_read_block(p, p->cfg)) < 0 || p->errors.parse ||
+        p->errors.arc) {
+      p->eof = 1;
+      return EXIT_FAILURE;
+    }
+    p->eof = (rv == 0);
+  }
+  return EXIT_SUCCESS;
+}
+
+// Free the executed blocks, except the last one: the current block still
+// needs its target as the starting point
+static void program_release(program_t *p) {
+  block_t *keep, *tmp;
+  if (!p->current || !(keep = block_prev(p->current)))
+    return;
+  while (p->first != keep) {
+    tmp = p->first;
+    p->first = block_next(tmp);
+    block_free(tmp);
+  }
+}
+
+// Map the whole file in memory and create the blocks in place: each newline
+// is replaced by a terminator, so that blocks can refer to their line without
+// copying it. The mapping is private, so the file on disk is never touched.
+// Falls back to LOAD_GETLINE if the file cannot be mapped (e.g. a pipe)
+static int program_parse_mmap(program_t *p, machine_t *cfg) {
+  char *line, *eol, *end;
+  int rv = EXIT_SUCCESS;
+
+  if (program_map(p))
+    return program_parse_getline(p, cfg);
+
+  line = p->map;
+  end = p->map + p->map_len;
+  while (line < end) {
+    if ((eol = memchr(line, '\n', end - line))) {
+      *eol = '\0';
+      rv = program_append(p, block_new_in(p->arena, line, p->last, cfg), line);
+      line = eol + 1;
+    }
+    else { // last line without newline: there is no room for a terminator
+      char *last = arena_strndup(p->arena, line, end - line);
+      if (!last) {
+        perror("Could not allocate line");
+        return EXIT_FAILURE;
+      }
+      rv = program_append(p, block_new_in(p->arena, last, p->last, cfg), last);
+      line = end;
+    }
+    if (rv) break;
+  }
+  return rv;
+}
+
+// Two-phase parsing on p->threads threads. The file is mapped and split
+// into lines, then:
+// 1. blocks are created and tokenized in parallel, one chunk per thread
+// 2. modal fields are inherited in a sequential pass (cheap: no parsing)
+// 3. geometry and velocity profiles are computed in parallel
+// Falls back to the sequential LOAD_GETLINE if the file cannot be mapped
+static int program_parse_parallel(program_t *p, machine_t *cfg) {
+  char *line, *eol = NULL, *end, *tail = NULL;
+  program_chunk_t proto = {0};
+  size_t n = 0, cap = 0, i;
+  int rv = EXIT_SUCCESS;
+
+  if (program_map(p))
+    return program_parse_getline(p, cfg);
+  // split lines
+  line = p->map;
+  end = p->map + p->map_len;
+  while (line < end) {
+    if (n == cap) {
+      cap = cap ? cap * 2 : 1024;
+      char **tmp = (char **)realloc(proto.lines, cap * sizeof(char *));
+      if (!tmp) {
+        perror("Could not allocate lines");
+        free(proto.lines);
+        return EXIT_FAILURE;
+      }
+      proto.lines = tmp;
+    }
+    if ((eol = memchr(line, '\n', end - line))) {
+      *eol = '\0';
+      proto.lines[n++] = line;
+      line = eol + 1;
+    }
+    else { // last line without newline: there is no room for a terminator
+      if (!(tail = strndup(line, end - line))) {
+        perror("Could not allocate line");
+        free(proto.lines);
+        return EXIT_FAILURE;
+      }
+      proto.lines[n++] = tail;
+      line = end;
+    }
+  }
+  if (n == 0) {
+    free(proto.lines);
+    return EXIT_SUCCESS;
+  }
+  if (!(proto.blocks = (block_t **)calloc(n, sizeof(block_t *)))) {
+    perror("Could not allocate blocks");
+    free(proto.lines);
+    free(tail);
+    return EXIT_FAILURE;
+  }
+  proto.tail = tail;
+  proto.cfg = cfg;
+
+  // phase 1: create blocks and tokenize
+  rv = program_run_chunks(p, &proto, n, program_scan_chunk,
+                          &p->errors.parse);
+  // if any allocation failed, give up (blocks are freed with the arena)
+  for (i = 0; i < n; i++) {
+    if (!proto.blocks[i]) {
+      rv = EXIT_FAILURE;
+      goto cleanup;
+    }
+  }
+  // phase 2: inherit modal state (also builds the linked list, so that
+  // program_free can release the blocks even in case of errors)
+  for (i = 0; i < n; i++)
+    block_inherit(proto.blocks[i], i > 0 ? proto.blocks[i - 1] : NULL);
+  p->first = proto.blocks[0];
+  p->last = proto.blocks[n - 1];
+  p->n = n;
+  // phase 3: geometry and profiles (also of the blocks with errors, so that
+  // all the errors are found)
+  if (rv == EXIT_SUCCESS)
+    rv = program_run_chunks(p, &proto, n, program_plan_chunk,
+                            &p->errors.arc);
+
+cleanup:
+  free(proto.blocks);
+  free(proto.lines);
+  free(tail);
+  return rv;
+}
+
+// Map the file in p->map. Return EXIT_FAILURE if it cannot be mapped
+static int program_map(program_t *p) {
+  struct stat st;
+  int fd;
+
+  if ((fd = open(p->filename, O_RDONLY)) < 0)
+    return EXIT_FAILURE;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return EXIT_FAILURE;
+  }
+  if (st.st_size == 0) { // nothing to map
+    close(fd);
+    return EXIT_SUCCESS;
+  }
+  p->map_len = st.st_size;
+  p->map = mmap(NULL, p->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p->map == MAP_FAILED) {
+    p->map = NULL;
+    p->map_len = 0;
+    return EXIT_FAILURE;
+  }
+  madvise(p->map, p->map_len, MADV_SEQUENTIAL);
+  return EXIT_SUCCESS;
+}
+
+// Split the n blocks in p->threads contiguous chunks and run work on each of
+// them on a separate thread. The errors found in the blocks are added to
+// errors: the return value is EXIT_FAILURE only if the threads could not
+// be set up
+static int program_run_chunks(program_t *p, program_chunk_t *proto, size_t n,
+                              void *(*work)(void *), size_t *errors) {
+  size_t nt = MIN(p->threads, n), i;
+  size_t size = n / nt, extra = n % nt, from = 0;
+  program_chunk_t *chunks;
+
+  if (!(chunks = (program_chunk_t *)calloc(nt, sizeof(program_chunk_t)))) {
+    perror("Could not allocate parsing threads");
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < nt; i++) {
+    chunks[i] = *proto;
+    chunks[i].from = from;
+    chunks[i].to = from + size + (i < extra ? 1 : 0);
+    from = chunks[i].to;
+  }
+  // the calling thread takes the first chunk; if a thread cannot be
+  // created, its chunk is processed by the calling thread as well
+  for (i = 1; i < nt; i++)
+    chunks[i].running =
+        !pthread_create(&chunks[i].tid, NULL, work, &chunks[i]);
+  for (i = 0; i < nt; i++) {
+    if (chunks[i].running)
+      pthread_join(chunks[i].tid, NULL);
+    else
+      work(&chunks[i]);
+    *errors += chunks[i].errors;
+    // the blocks of each thread go to the program arena
+    if (chunks[i].arena)
+      arena_adopt(p->arena, chunks[i].arena);
+  }
+  free(chunks);
+  return EXIT_SUCCESS;
+}
+
+static void *program_scan_chunk(void *arg) {
+  program_chunk_t *c = (program_chunk_t *)arg;
+  block_t *b = NULL;
+  char *line;
+  size_t i;
+  // each thread has its own arena, so that allocation is lock-free
+  if (!(c->arena = arena_new(0))) {
+    c->errors++;
+    return NULL;
+  }
+  for (i = c->from; i < c->to; i++) {
+    // the unterminated last line is not in the mapping, copy it
+    line = c->lines[i];
+    if (line == c->tail)
+      line = arena_strdup(c->arena, line);
+    // modal fields are inherited later on, hence no previous block here
+    b = line ? block_new_in(c->arena, line, NULL, c->cfg) : NULL;
+    if (!(c->blocks[i] = b)) {
+      fprintf(stderr, "ERROR: creating the block %s\n", c->lines[i]);
+      c->errors++;
+    }
+    else if (block_scan(b)) {
+      fprintf(stderr, "ERROR: parsing the block %s\n", c->lines[i]);
+      c->errors++;
+    }
+  }
+  return NULL;
+}
+
+static void *program_plan_chunk(void *arg) {
+  program_chunk_t *c = (program_chunk_t *)arg;
+  size_t i;
+  for (i = c->from; i < c->to; i++) {
+    if (block_plan(c->blocks[i])) {
+      fprintf(stderr, "ERROR: parsing the block %s\n", c->lines[i]);
+      c->errors++;
+    }
+  }
+  return NULL;
+}
+
+// Fill the cache header for the current G-code file and machine
+static int program_cache_header(program_t *p, machine_t *cfg,
+                                program_cache_t *h) {
+  struct stat st;
+  char *data;
+  int fd;
+
+  if ((fd = open(p->filename, O_RDONLY)) < 0)
+    return EXIT_FAILURE;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return EXIT_FAILURE;
+  }
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, CACHE_MAGIC, sizeof(h->magic));
+  h->version = CACHE_VERSION;
+  h->data_size = sizeof(data_t);
+  h->size_size = sizeof(size_t);
+  h->length = st.st_size;
+  h->A = machine_A(cfg);
+  h->tq = machine_tq(cfg);
+  h->error = machine_error(cfg);
+  h->J = machine_J(cfg);
+  h->zero[0] = point_x(machine_zero(cfg));
+  h->zero[1] = point_y(machine_zero(cfg));
+  h->zero[2] = point_z(machine_zero(cfg));
+  h->lookahead = p->lookahead > 1 ? p->lookahead : 0;
+  h->simplify = p->simplify;
+  if (st.st_size > 0) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return EXIT_FAILURE;
+    }
+    h->hash = program_hash(data, st.st_size);
+    munmap(data, st.st_size);
+  }
+  close(fd);
+  return EXIT_SUCCESS;
+}
+
+// Restore all the blocks from the cache file, if it matches key. The cache
+// file is mapped, and blocks refer to their lines within the mapping
+static int program_cache_load(program_t *p, machine_t *cfg,
+                              const program_cache_t *key) {
+  program_cache_t h;
+  compiled_t *c = NULL;
+  struct stat st;
+  char *path, *line, *end, *map;
+  size_t i, len, n = 0;
+  int fd;
+
+  if (asprintf(&path, "%s%s", p->filename, CACHE_EXT) == -1)
+    return EXIT_FAILURE;
+  fd = open(path, O_RDONLY);
+  free(path);
+  if (fd < 0)
+    return EXIT_FAILURE;
+  // the whole header (content hash and machine parameters) must match
+  if (pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+      memcmp(&h, key, offsetof(program_cache_t, n))) {
+    close(fd);
+    return EXIT_FAILURE;
+  }
+  // a truncated file cannot be mapped safely
+  len = sizeof(h) + h.data_len + h.lines_len;
+  if (fstat(fd, &st) || (size_t)st.st_size != len) {
+    close(fd);
+    return EXIT_FAILURE;
+  }
+  map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return EXIT_FAILURE;
+  if (!(c = compiled_wrap(map + sizeof(h), h.n, cfg)) ||
+      compiled_size(c) != h.data_len) {
+    goto fail;
+  }
+  // check that there is a terminated line for every block
+  line = map + sizeof(h) + h.data_len;
+  end = line + h.lines_len;
+  while (line < end && (line = memchr(line, '\0', end - line))) {
+    line++;
+    n++;
+  }
+  if (n != h.n)
+    goto fail;
+
+  line = map + sizeof(h) + h.data_len;
+  for (i = 0; i < h.n; i++) {
+    block_t *b = block_restore(c, i, p->arena, line, p->last, cfg);
+    if (!b)
+      goto fail;
+    if (p->first == NULL) p->first = b;
+    p->last = b;
+    p->n++;
+    line += strlen(line) + 1;
+  }
+  compiled_free(c);
+  p->map = map;
+  p->map_len = len;
+  return EXIT_SUCCESS;
+
+fail:
+  if (c)
+    compiled_free(c);
+  munmap(map, len);
+  // blocks restored so far are released with the arena
+  p->first = p->last = NULL;
+  p->n = 0;
+  return EXIT_FAILURE;
+}
+
+// Write the cache file: to a temporary file first, then renamed, so that
+// concurrent runs never see a partial cache
+static int program_cache_save(program_t *p, machine_t *cfg,
+                              const program_cache_t *key) {
+  program_cache_t h = *key;
+  compiled_t *c;
+  block_t *b;
+  char *path, *tmp;
+  FILE *f;
+  int rv = EXIT_SUCCESS;
+
+  if (!(c = compiled_new(p, cfg)))
+    return EXIT_FAILURE;
+  h.n = compiled_count(c);
+  h.data_len = compiled_size(c);
+  h.lines_len = 0;
+  for (b = p->first; b; b = block_next(b))
+    h.lines_len += strlen(block_line(b)) + 1;
+
+  if (asprintf(&path, "%s%s", p->filename, CACHE_EXT) == -1) {
+    compiled_free(c);
+    return EXIT_FAILURE;
+  }
+  if (asprintf(&tmp, "%s.%d", path, (int)getpid()) == -1) {
+    free(path);
+    compiled_free(c);
+    return EXIT_FAILURE;
+  }
+  if (!(f = fopen(tmp, "wb"))) {
+    rv = EXIT_FAILURE;
+  }
+  else {
+    if (fwrite(&h, sizeof(h), 1, f) != 1 ||
+        fwrite(compiled_data(c), 1, h.data_len, f) != h.data_len)
+      rv = EXIT_FAILURE;
+    for (b = p->first; b && rv == EXIT_SUCCESS; b = block_next(b)) {
+      if (fputs(block_line(b), f) == EOF || fputc('\0', f) == EOF)
+        rv = EXIT_FAILURE;
+    }
+    if (fclose(f))
+      rv = EXIT_FAILURE;
+    if (rv == EXIT_SUCCESS && rename(tmp, path))
+      rv = EXIT_FAILURE;
+    if (rv != EXIT_SUCCESS)
+      unlink(tmp);
+  }
+  free(tmp);
+  free(path);
+  compiled_free(c);
+  return rv;
+}
+
+// 64-bit hash of the file content, eight bytes at a time (not meant to be
+// cryptographically secure, only to detect changes)
+static uint64_t program_hash(const char *data, size_t len) {
+  uint64_t h = 0x9E3779B97F4A7C15ULL ^ len, w;
+  size_t i;
+  for (i = 0; i + 8 <= len; i += 8) {
+    memcpy(&w, data + i, 8);
+    h ^= w * 0xBF58476D1CE4E5B9ULL;
+    h = ((h << 31) | (h >> 33)) * 0x94D049BB133111EBULL;
+  }
+  for (; i < len; i++) {
+    h ^= (unsigned char)data[i];
+    h *= 0x100000001B3ULL;
+  }
+  h ^= h >> 29;
+  return h;
+}
+
+// Plan the boundary speeds of b, looking at most p->lookahead blocks ahead.
+// The entry speed is the exit speed of the previous block (already planned).
+// The exit speed comes from:
+// - a backward pass from the last block in the window, which is assumed to
+//   stop at its end (the following blocks are not known yet), limiting
+//   each junction to block_junction and to the speed from which the
+//   following blocks can still decelerate down to the stop;
+// - a forward pass, limiting it to what b can reach from its entry speed.
+// Non-motion blocks stop the machine, as their junctions are 0.
+static void program_plan_speeds(program_t *p, block_t *b) {
+  block_t *end = b, *prev = block_prev(b);
+  data_t vi = prev ? block_profile(prev)->vf : 0;
+  data_t vf = 0;
+  size_t k;
+  if (block_type(b) != LINE && block_type(b) != ARC_CW &&
+      block_type(b) != ARC_CCW)
+    return;
+  for (k = 1; k < p->lookahead && block_next(end); k++)
+    end = block_next(end);
+  // backward pass: vf is the max entry speed of end
+  // (fmin, unlike MIN, drops NaNs coming from broken blocks)
+  for (; end != b; end = block_prev(end)) {
+    vf = fmin(block_junction(end), block_reachable(end, vf));
+  }
+  // forward pass
+  vf = fmin(vf, block_reachable(b, vi));
+  block_set_speeds(b, vi, vf);
+}
+
+// Add the time of block b to the estimate
+static int program_estimate_add(program_estimate_t *est, const block_t *b,
+                                machine_t *cfg) {
+  size_t tool = block_tool(b), lo = 0, hi = est->tools, mid;
+  program_tool_time_t *tools;
+  data_t dt;
+  est->blocks++;
+  switch (block_type(b)) {
+  case RAPID:
+    dt = program_rapid_time(b, cfg);
+    est->rapid += dt;
+    break;
+  case LINE:
+  case ARC_CW:
+  case ARC_CCW:
+    dt = block_dt(b);
+    est->feed += dt;
+    break;
+  default:
+    return EXIT_SUCCESS;
+  }
+  est->total += dt;
+  // binary search of the tool: lo is where it is, or where it goes
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (est->tool[mid].number < tool)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  // programs use a handful of tools: they are inserted one at a time
+  if (lo == est->tools || est->tool[lo].number != tool) {
+    tools = (program_tool_time_t *)realloc(
+        est->tool, (est->tools + 1) * sizeof(program_tool_time_t));
+    if (!tools) {
+      perror("Could not allocate the tool times");
+      return EXIT_FAILURE;
+    }
+    memmove(tools + lo + 1, tools + lo,
+            (est->tools - lo) * sizeof(program_tool_time_t));
+    tools[lo].number = tool;
+    tools[lo].time = 0;
+    est->tool = tools;
+    est->tools++;
+  }
+  est->tool[lo].time += dt;
+  return EXIT_SUCCESS;
+}
+
+// Estimate a program parsed as a whole by program_parse, so that its cache
+// is used (or written)
+static int program_estimate_parsed(program_t *p, machine_t *cfg,
+                                   program_estimate_t *est) {
+  block_t *b;
+  p->load = LOAD_MMAP;
+  if (program_parse(p, cfg))
+    return EXIT_FAILURE;
+  while ((b = program_next(p))) {
+    if (program_estimate_add(est, b, cfg)) {
+      program_estimate_free(est);
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// Estimate the programs of a batch until there are none left
+static void *program_estimate_worker(void *arg) {
+  program_batch_t *batch = (program_batch_t *)arg;
+  program_t *p;
+  size_t i;
+  while ((i = atomic_fetch_add(&batch->next, 1)) < batch->n) {
+    p = program_new(batch->files[i]);
+    if (p) {
+      program_set_lookahead(p, batch->lookahead);
+      program_set_cache(p, batch->cache);
+    }
+    if (!p || program_estimate(p, batch->cfg, &batch->est[i])) {
+      memset(&batch->est[i], 0, sizeof(program_estimate_t));
+      atomic_fetch_add(&batch->failures, 1);
+    }
+    if (p)
+      program_free(p);
+  }
+  return NULL;
+}
+
+// Replace runs of G01 blocks with single blocks, within machine_error: merge
+// is block_merge or block_fit_arc
+static void program_merge_blocks(program_t *p, machine_t *cfg,
+                                 size_t (*merge)(block_t *, data_t, size_t)) {
+  block_t *b;
+  for (b = p->first; b; b = block_next(b)) {
+    p->n -= merge(b, machine_error(cfg), SIMPLIFY_MAX);
+    p->last = b;
+  }
+}
+
+// Open the file and start the stages of LOAD_PIPELINE
+static int program_pipeline_start(program_t *p) {
+  program_pipeline_t *pl;
+  if (!(p->file = fopen(p->filename, "r"))) {
+    fprintf(stderr, "ERROR: cannot open the file %s\n", p->filename);
+    return EXIT_FAILURE;
+  }
+  if (!(pl = (program_pipeline_t *)calloc(1, sizeof(program_pipeline_t)))) {
+    perror("Could not create the pipeline");
+    fclose(p->file);
+    p->file = NULL;
+    return EXIT_FAILURE;
+  }
+  p->pipe = pl;
+  memset(&p->errors, 0, sizeof(p->errors));
+  atomic_init(&pl->error, 0);
+  if (!(pl->parsed = queue_new(p->window)) ||
+      !(pl->planned = queue_new(p->window))) {
+    program_pipeline_stop(p);
+    return EXIT_FAILURE;
+  }
+  // threads are counted as they start, so that stop joins only those
+  if (!(errno = pthread_create(&pl->parse, NULL, program_parse_stage, p)))
+    pl->running++;
+  if (pl->running == 1 &&
+      !(errno = pthread_create(&pl->plan, NULL, program_plan_stage, p)))
+    pl->running++;
+  if (pl->running < 2) {
+    perror("Could not start the pipeline threads");
+    program_pipeline_stop(p);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Stop the stages (wherever they are) and free all the blocks
+static void program_pipeline_stop(program_t *p) {
+  program_pipeline_t *pl = p->pipe;
+  block_t *b, *tmp;
+  if (!pl)
+    return;
+  // closing the queues from the consumer side stops the producers as well
+  if (pl->planned)
+    queue_close(pl->planned);
+  if (pl->parsed)
+    queue_close(pl->parsed);
+  if (pl->running > 0)
+    pthread_join(pl->parse, NULL);
+  if (pl->running > 1)
+    pthread_join(pl->plan, NULL);
+  // all the blocks not freed yet are linked, oldest first: those kept by
+  // program_next, then those queued or held by the stages
+  b = p->first ? p->first : pl->first;
+  while (b) {
+    tmp = b;
+    b = block_next(b);
+    block_free(tmp);
+  }
+  if (pl->planned)
+    queue_free(pl->planned);
+  if (pl->parsed)
+    queue_free(pl->parsed);
+  free(pl);
+  p->pipe = NULL;
+  if (p->file)
+    fclose(p->file);
+  p->file = NULL;
+  p->first = p->last = p->current = NULL;
+  p->n = p->pos = 0;
+  p->failed = 0;
+}
+
+// Take the next planned block, freeing the executed ones
+static block_t *program_pipeline_next(program_t *p) {
+  void *b;
+  if (!p->pipe || queue_pop(p->pipe->planned, &b)) {
+    p->failed = !p->pipe || atomic_load(&p->pipe->error);
+    p->current = NULL;
+    return NULL;
+  }
+  p->current = (block_t *)b;
+  if (!p->first)
+    p->first = p->current;
+  p->last = p->current;
+  p->n++;
+  p->pos++;
+  program_release(p);
+  return p->current;
+}
+
+// Parse stage: read the file, create and tokenize the blocks and link them
+static void *program_parse_stage(void *arg) {
+  program_t *p = (program_t *)arg;
+  program_pipeline_t *pl = p->pipe;
+  block_t *b, *last = NULL;
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+  int rv;
+  while ((len = getline(&line, &size, p->file)) >= 0) {
+    if (len > 0 && line[len - 1] == '\n')
+      line[len - 1] = '\0';
+    // the previous block may be being planned: it is only read by
+    // block_inherit, for the modal fields that planning does not touch
+    if (!(b = block_new(line, NULL, p->cfg))) {
+      fprintf(stderr, "ERROR: creating the block %s\n", line);
+      atomic_store(&pl->error, 1);
+      break;
+    }
+    rv = block_scan(b);
+    block_inherit(b, last);
+    if (!last)
+      pl->first = b;
+    last = b;
+    if (rv) {
+      fprintf(stderr, "ERROR: parsing the block %s\n", line);
+      p->errors.parse++;
+      atomic_store(&pl->error, 1);
+      break;
+    }
+    if (queue_push(pl->parsed, b))
+      break;
+  }
+  free(line);
+  queue_close(pl->parsed);
+  return NULL;
+}
+
+// Plan stage: compute geometry and velocity profiles. With look-ahead, a
+// block is held until the following lookahead - 1 blocks are planned, then
+// its boundary speeds are planned as by program_parse
+static void *program_plan_stage(void *arg) {
+  program_t *p = (program_t *)arg;
+  program_pipeline_t *pl = p->pipe;
+  size_t window = MAX(p->lookahead, 1), held = 0;
+  block_t *b, *oldest = NULL;
+  void *item;
+  while (!queue_pop(pl->parsed, &item)) {
+    b = (block_t *)item;
+    if (block_plan(b)) {
+      fprintf(stderr, "ERROR: parsing the block %s\n", block_line(b));
+      p->errors.arc++;
+      atomic_store(&pl->error, 1);
+      queue_close(pl->parsed);
+      break;
+    }
+    if (!oldest)
+      oldest = b;
+    if (++held == window && program_plan_send(p, &oldest, &held))
+      break;
+  }
+  // at the end of the program, the last blocks have no more blocks ahead
+  while (!atomic_load(&pl->error) && held &&
+         !program_plan_send(p, &oldest, &held))
+    ;
+  queue_close(pl->planned);
+  return NULL;
+}
+
+// Plan the speeds of the oldest block held by the plan stage and send it on.
+// Returns 1 if it cannot be sent (program_next has stopped)
+static int program_plan_send(program_t *p, block_t **oldest, size_t *held) {
+  block_t *b = *oldest;
+  if (p->lookahead > 1)
+    program_plan_speeds(p, b);
+  // the link is followed before sending b, and only if the next block has
+  // been popped already (otherwise, it is being written by the parse stage)
+  *oldest = --(*held) ? block_next(b) : NULL;
+  return queue_push(p->pipe->planned, b);
+}
@@ -12,6 +12,7 @@
 #include "defines.h"
 #include "block.h"
 #include "machine.h"
+#include "arena.h"
 
 //   _____                      
 //  |_   _|   _ _ __   ___  ___ 
@@ -23,6 +24,43 @@
 // Opaque structure
 typedef struct program program_t;
 
+// Loading strategies for program_parse
+typedef enum {
+  LOAD_GETLINE = 0, // read one line at a time, each block copies its line
+  LOAD_MMAP,        // map the file, blocks refer to slices of the mapping
+  LOAD_STREAM,      // parse lazily in program_next, within a bounded window
+  LOAD_PIPELINE     // parse and plan ahead on threads (see program_parse)
+} program_load_t;
+
+// Path simplifications for program_set_simplify (can be or-ed)
+typedef enum {
+  SIMPLIFY_NONE = 0,
+  SIMPLIFY_LINES = 1 << 0, // merge collinear G01 blocks
+  SIMPLIFY_ARCS = 1 << 1   // replace runs of G01 blocks with G02/G03 arcs
+} program_simplify_t;
+
+// Errors found in the blocks of a program (see program_errors)
+typedef struct {
+  size_t parse; // blocks that cannot be tokenized (e.g. malformed words)
+  size_t arc;   // arcs whose end point is not on their circle
+} program_errors_t;
+
+// Motion time with a tool (T word), in seconds
+typedef struct {
+  size_t number; // T word
+  data_t time;   // time of the blocks with this tool
+} program_tool_time_t;
+
+// Machining time estimate of a program (see program_estimate), in seconds
+typedef struct {
+  data_t total;              // total time
+  data_t feed;               // time of the G01/G02/G03 blocks
+  data_t rapid;              // time of the G00 blocks
+  size_t blocks;             // number of blocks
+  size_t tools;              // number of elements of tool
+  program_tool_time_t *tool; // tools used, sorted by T word
+} program_estimate_t;
+
 
 //   _____                 _   _                 
 //  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___ 
@@ -41,21 +79,117 @@ void program_free(program_t *program);
 // print a program description
 void program_print(const program_t *program, FILE *output);
 
+// select the loading strategy (default: LOAD_GETLINE)
+void program_set_load(program_t *program, program_load_t load);
+
+// set the number of blocks parsed ahead of the current one (default: 32).
+// Only used with LOAD_STREAM: program_parse only parses the first window,
+// program_next keeps it full and frees the blocks already executed, so that
+// memory usage does not depend on the program length. With LOAD_PIPELINE,
+// it is the size of each queue between the stages
+void program_set_window(program_t *program, size_t window);
+
+// set the number of threads used by program_parse (default: 1). With more
+// than one thread, tokenizing and profile computation run in parallel, while
+// modal fields are still inherited sequentially. 0 means one per online CPU.
+// Only used with LOAD_MMAP, on files that can be mapped: otherwise, parsing
+// is sequential
+void program_set_threads(program_t *program, size_t threads);
+
+// enable the compiled cache (default: disabled). program_parse then looks
+// for a <filename>.ccncb file holding the already parsed and planned blocks:
+// if it matches the G-code content and the machine parameters, blocks are
+// restored from there without parsing; otherwise, the file is (re)written
+// after parsing. Not used with LOAD_STREAM and LOAD_PIPELINE
+void program_set_cache(program_t *program, int cache);
+
+// set the look-ahead window of the planner (default: 0, disabled): each
+// motion block is joined to the next one at the highest speed that still
+// lets the machine stop within the following blocks of the window, rather
+// than stopping at its end. With LOAD_STREAM, the window is also limited by
+// the blocks parsed ahead (see program_set_window)
+void program_set_lookahead(program_t *program, size_t blocks);
+
+// simplify the path, as long as it stays within machine_error from the
+// original one (default: SIMPLIFY_NONE). Runs of consecutive G01 blocks with
+// the same feedrate, spindle and tool are replaced with single blocks: arcs
+// with SIMPLIFY_ARCS (see block_fit_arc), lines with SIMPLIFY_LINES (see
+// block_merge); arcs are fitted first. Simplification happens after
+// parsing, before the look-ahead planning. Not used with LOAD_STREAM and
+// LOAD_PIPELINE
+void program_set_simplify(program_t *program, int simplify);
+
 // PROCESSING ==================================================================
 
 // parse the program
 // return either EXIT_SUCCESS or EXIT_FAILURE
+// Blocks with errors do not stop parsing: all the blocks are checked, so
+// that all the errors are reported (and counted, see program_errors), then
+// the program fails. LOAD_STREAM and LOAD_PIPELINE stop at the first error
+// With LOAD_PIPELINE, this only opens the file and starts two threads, each
+// a stage connected to the next one by a bounded queue (see
+// program_set_window): the first one creates and tokenizes the blocks and
+// links them, the second one computes their geometry and velocity profiles
+// (and, with look-ahead, their boundary speeds), while program_next takes
+// the planned blocks. A full queue holds the stage before it back, so that
+// memory usage does not depend on the program length, and a slow block
+// (e.g. an arc) delays the following ones, not those already planned
 int program_parse(program_t *program, machine_t *cfg);
 
 // linked-list navigation functions
+// With LOAD_STREAM and LOAD_PIPELINE, program_next returns NULL also on
+// parsing errors and frees the blocks already executed, and program_reset
+// restarts parsing from the beginning of the file. With LOAD_PIPELINE, only
+// the blocks returned by program_next (and the previous one) can be
+// accessed, and block_next of the current block is not to be used
 block_t *program_next(program_t *program);
 void program_reset(program_t *program);
 
 
+// ESTIMATE ====================================================================
+
+// Estimate the machining time of a program in a single streaming pass, with
+// its look-ahead setting (the loading strategy is not used): blocks are
+// parsed and planned as by program_parse, but only the few blocks of the
+// look-ahead window are kept at a time, and their memory is recycled.
+// G00 blocks are estimated as trapezoids at machine_rapid feedrate.
+// With the cache enabled (see program_set_cache), the whole program is
+// parsed instead, as by program_parse with LOAD_MMAP, so that the cache is
+// used and kept up to date.
+// The estimate must be released with program_estimate_free.
+// Returns EXIT_SUCCESS or EXIT_FAILURE (on parsing errors)
+int program_estimate(program_t *program, machine_t *cfg,
+                     program_estimate_t *est);
+void program_estimate_free(program_estimate_t *est);
+
+// Estimate n program files in parallel, on threads threads (0 for one per
+// online CPU), each with the given look-ahead window and cache setting (see
+// program_set_cache): est[i] is the estimate of files[i] (all zeros if it
+// failed). Returns the number of failures
+size_t program_estimate_many(const char *const *files, size_t n,
+                             machine_t *cfg, size_t lookahead, int cache,
+                             size_t threads, program_estimate_t *est);
+
+// Time of the rapid (G00) block b (s), as estimated by program_estimate: at
+// max acceleration machine_A and feedrate machine_rapid
+data_t program_rapid_time(const block_t *b, machine_t *cfg);
+
+
 // GETTERS =====================================================================
 
 char *program_filename(const program_t *p);
 size_t program_length(const program_t *p);
+program_load_t program_load(const program_t *p);
+size_t program_threads(const program_t *p);
+size_t program_window(const program_t *p);
+size_t program_lookahead(const program_t *p);
+int program_simplify(const program_t *p);
+// True if program_next has returned NULL because of an error rather than at
+// the end of the program (LOAD_STREAM and LOAD_PIPELINE)
+int program_failed(const program_t *p);
+// Errors found by the last program_parse (with LOAD_STREAM and LOAD_PIPELINE,
+// also by program_next, once it has returned NULL)
+program_errors_t program_errors(const program_t *p);
 block_t *program_current(const program_t *p);
 block_t *program_first(const program_t *p);
 block_t *program_last(const program_t *p);
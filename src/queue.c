@@ -0,0 +1,108 @@
+//    ___
+//   / _ \ _   _  ___ _   _  ___
+//  | | | | | | |/ _ \ | | |/ _ \
+//  | |_| | |_| |  __/ |_| |  __/
+//   \__\_\\__,_|\___|\__,_|\___|
+// queue.c
+
+#include "queue.h"
+#include <pthread.h>
+
+
+//   ____            _                 _   _
+//  |  _ \  ___  ___| | __ _ _ __ __ _| |_(_) ___  _ __  ___
+//  | | | |/ _ \/ __| |/ _` | '__/ _` | __| |/ _ \| '_ \/ __|
+//  | |_| |  __/ (__| | (_| | | | (_| | |_| | (_) | | | \__ \
+//  |____/ \___|\___|_|\__,_|_|  \__,_|\__|_|\___/|_| |_|___/
+
+// Queue object structure: a circular buffer protected by a mutex
+typedef struct queue {
+  void **item;               // slots
+  size_t capacity;           // number of slots
+  size_t head, count;        // oldest item and number of items
+  int closed;                // true after queue_close
+  pthread_mutex_t lock;      // protects all the fields above
+  pthread_cond_t not_full;   // signaled when an item is popped
+  pthread_cond_t not_empty;  // signaled when an item is pushed
+} queue_t;
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+queue_t *queue_new(size_t capacity) {
+  queue_t *q = (queue_t *)calloc(1, sizeof(queue_t));
+  if (!q) {
+    perror("Could not create queue");
+    return NULL;
+  }
+  q->capacity = MAX(capacity, 1);
+  if (!(q->item = (void **)calloc(q->capacity, sizeof(void *)))) {
+    perror("Could not allocate queue slots");
+    free(q);
+    return NULL;
+  }
+  q->head = q->count = 0;
+  q->closed = 0;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->not_full, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  return q;
+}
+
+void queue_free(queue_t *q) {
+  assert(q);
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->not_full);
+  pthread_cond_destroy(&q->not_empty);
+  free(q->item);
+  free(q);
+}
+
+// PROCESSING ==================================================================
+
+int queue_push(queue_t *q, void *item) {
+  assert(q);
+  pthread_mutex_lock(&q->lock);
+  while (q->count == q->capacity && !q->closed)
+    pthread_cond_wait(&q->not_full, &q->lock);
+  if (q->closed) {
+    pthread_mutex_unlock(&q->lock);
+    return 1;
+  }
+  q->item[(q->head + q->count++) % q->capacity] = item;
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+  return 0;
+}
+
+int queue_pop(queue_t *q, void **item) {
+  assert(q && item);
+  pthread_mutex_lock(&q->lock);
+  while (q->count == 0 && !q->closed)
+    pthread_cond_wait(&q->not_empty, &q->lock);
+  if (q->count == 0) {
+    pthread_mutex_unlock(&q->lock);
+    return 1;
+  }
+  *item = q->item[q->head];
+  q->head = (q->head + 1) % q->capacity;
+  q->count--;
+  pthread_cond_signal(&q->not_full);
+  pthread_mutex_unlock(&q->lock);
+  return 0;
+}
+
+void queue_close(queue_t *q) {
+  assert(q);
+  pthread_mutex_lock(&q->lock);
+  q->closed = 1;
+  pthread_cond_broadcast(&q->not_full);
+  pthread_cond_broadcast(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
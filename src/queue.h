@@ -0,0 +1,54 @@
+//    ___
+//   / _ \ _   _  ___ _   _  ___
+//  | | | | | | |/ _ \ | | |/ _ \
+//  | |_| | |_| |  __/ |_| |  __/
+//   \__\_\\__,_|\___|\__,_|\___|
+//  Blocking queue between pipeline stages
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "defines.h"
+
+//   _____
+//  |_   _|   _ _ __   ___  ___
+//    | || | | | '_ \ / _ \/ __|
+//    | || |_| | |_) |  __/\__ \
+//    |_| \__, | .__/ \___||___/
+//        |___/|_|
+
+// Opaque structure: a bounded FIFO of pointers, shared by any number of
+// producer and consumer threads. Unlike the ring (see ring.h), it blocks:
+// pushing waits while the queue is full, so that a fast producer is held
+// back by a slow consumer (backpressure), and popping waits while it is
+// empty. Not meant for real-time threads
+typedef struct queue queue_t;
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+// Queue of at most capacity items (at least 1)
+queue_t *queue_new(size_t capacity);
+// The items still queued are not freed
+void queue_free(queue_t *q);
+
+// PROCESSING ==================================================================
+
+// Append an item, waiting for room; returns 1 if the queue is closed
+// (nothing is appended)
+int queue_push(queue_t *q, void *item);
+// Take the oldest item, waiting for one; returns 1 once the queue is closed
+// and empty
+int queue_pop(queue_t *q, void **item);
+// No more items will be pushed; wakes up all the waiting threads. Called by
+// a consumer, it also makes the producers stop
+void queue_close(queue_t *q);
+
+
+#endif // QUEUE_H
@@ -0,0 +1,238 @@
+//   ____  _
+//  |  _ \(_)_ __   __ _
+//  | |_) | | '_ \ / _` |
+//  |  _ <| | | | | (_| |
+//  |_| \_\_|_| |_|\__, |
+//                 |___/
+// ring.c
+
+#include "ring.h"
+#include <stdatomic.h>
+
+
+//   ____            _                 _   _
+//  |  _ \  ___  ___| | __ _ _ __ __ _| |_(_) ___  _ __  ___
+//  | | | |/ _ \/ __| |/ _` | '__/ _` | __| |/ _ \| '_ \/ __|
+//  | |_| |  __/ (__| | (_| | | | (_| | |_| | (_) | | | \__ \
+//  |____/ \___|\___|_|\__,_|_|  \__,_|\__|_|\___/|_| |_|___/
+
+// Cache line size: the fields written by each side are kept on separate
+// lines, so that the two threads do not invalidate each other's cache
+#define RING_LINE 64
+
+// Ring object structure. head and tail grow forever (they do not wrap
+// before 2^64 setpoints), the slot of a setpoint is its index & mask
+typedef struct ring {
+  executor_setpoint_t *buf; // slots
+  size_t mask;              // number of slots - 1
+  // written by the producer
+  _Alignas(RING_LINE) atomic_size_t head; // next setpoint to be pushed
+  size_t tail_cache;                      // last tail seen by the producer
+  atomic_size_t high_water;               // most setpoints ever in the ring
+  atomic_int closed;                      // true after ring_close
+  // written by the consumer
+  _Alignas(RING_LINE) atomic_size_t tail; // next setpoint to be popped
+  size_t head_cache;                      // last head seen by the consumer
+  atomic_size_t underruns;                // failed pops while open
+} ring_t;
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+ring_t *ring_new(size_t capacity) {
+  ring_t *r;
+  size_t n = 1;
+  while (n < capacity)
+    n <<= 1;
+  if (posix_memalign((void **)&r, RING_LINE, sizeof(ring_t))) {
+    perror("Could not create ring");
+    return NULL;
+  }
+  memset(r, 0, sizeof(ring_t));
+  if (!(r->buf = (executor_setpoint_t *)calloc(n, sizeof(*r->buf)))) {
+    perror("Could not allocate ring slots");
+    free(r);
+    return NULL;
+  }
+  r->mask = n - 1;
+  atomic_init(&r->head, 0);
+  atomic_init(&r->tail, 0);
+  atomic_init(&r->high_water, 0);
+  atomic_init(&r->underruns, 0);
+  atomic_init(&r->closed, 0);
+  return r;
+}
+
+void ring_free(ring_t *r) {
+  assert(r);
+  free(r->buf);
+  free(r);
+}
+
+// PRODUCER ====================================================================
+
+int ring_push(ring_t *r, const executor_setpoint_t *sp) {
+  assert(r && sp);
+  size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  // the tail is only read (with a cache miss) when the ring looks full
+  if (head - r->tail_cache > r->mask) {
+    r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - r->tail_cache > r->mask)
+      return 1;
+  }
+  r->buf[head & r->mask] = *sp;
+  // the slot is written before the consumer can see the new head
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  if (head + 1 - r->tail_cache >
+      atomic_load_explicit(&r->high_water, memory_order_relaxed)) {
+    r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head + 1 - r->tail_cache >
+        atomic_load_explicit(&r->high_water, memory_order_relaxed))
+      atomic_store_explicit(&r->high_water, head + 1 - r->tail_cache,
+                            memory_order_relaxed);
+  }
+  return 0;
+}
+
+void ring_close(ring_t *r) {
+  assert(r);
+  atomic_store_explicit(&r->closed, 1, memory_order_release);
+}
+
+// CONSUMER ====================================================================
+
+int ring_pop(ring_t *r, executor_setpoint_t *sp) {
+  assert(r && sp);
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  int closed;
+  if (tail == r->head_cache) {
+    // closed is read first: if it was set, head is final
+    closed = atomic_load_explicit(&r->closed, memory_order_acquire);
+    r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail == r->head_cache) {
+      if (!closed)
+        atomic_fetch_add_explicit(&r->underruns, 1, memory_order_relaxed);
+      return 1;
+    }
+  }
+  *sp = r->buf[tail & r->mask];
+  // the slot is read before the producer can reuse it
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return 0;
+}
+
+int ring_done(ring_t *r) {
+  assert(r);
+  return atomic_load_explicit(&r->closed, memory_order_acquire) &&
+         atomic_load_explicit(&r->tail, memory_order_relaxed) ==
+             atomic_load_explicit(&r->head, memory_order_acquire);
+}
+
+// GETTERS =====================================================================
+
+size_t ring_capacity(const ring_t *r) {
+  assert(r);
+  return r->mask + 1;
+}
+
+size_t ring_size(const ring_t *r) {
+  assert(r);
+  size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  return atomic_load_explicit(&r->head, memory_order_acquire) - tail;
+}
+
+size_t ring_high_water(const ring_t *r) {
+  assert(r);
+  return atomic_load_explicit(&r->high_water, memory_order_relaxed);
+}
+
+size_t ring_underruns(const ring_t *r) {
+  assert(r);
+  return atomic_load_explicit(&r->underruns, memory_order_relaxed);
+}
+
+
+
+//   _____ _____ ____ _____   __  __       _
+//  |_   _| ____/ ___|_   _| |  \/  | __ _(_)_ __
+//    | | |  _| \___ \ | |   | |\/| |/ _` | | '_ \
+//    | | | |___ ___) || |   | |  | | (_| | | | | |
+//    |_| |_____|____/ |_|   |_|  |_|\__,_|_|_| |_|
+// Only needed for testing purpose. To enable, compile as:
+// clang src/ring.c -o ring -lm -lpthread -DRING_MAIN
+#ifdef RING_MAIN
+#include <pthread.h>
+#define N 1000000
+
+// Producer: pushes setpoints numbered 0 to N - 1, spinning while full
+static void *producer(void *arg) {
+  ring_t *r = (ring_t *)arg;
+  executor_setpoint_t sp = {0};
+  for (size_t i = 0; i < N; i++) {
+    sp.n = i;
+    sp.t = (data_t)i;
+    while (ring_push(r, &sp))
+      ;
+  }
+  ring_close(r);
+  return NULL;
+}
+
+int main() {
+  executor_setpoint_t sp = {0};
+  ring_t *r = ring_new(5);
+  pthread_t tid;
+  size_t i, expected = 0;
+  int rv = 0;
+
+  // single thread: capacity, full, empty and closed states
+  rv += ring_capacity(r) != 8;
+  for (i = 0; i < 8; i++)
+    rv += ring_push(r, &sp);
+  rv += !ring_push(r, &sp);              // full
+  rv += ring_size(r) != 8 || ring_high_water(r) != 8;
+  for (i = 0; i < 8; i++)
+    rv += ring_pop(r, &sp);
+  rv += !ring_pop(r, &sp);               // empty and open: an underrun
+  rv += ring_underruns(r) != 1 || ring_done(r);
+  rv += ring_push(r, &sp);
+  ring_close(r);
+  rv += ring_done(r);                    // closed, but not empty
+  rv += ring_pop(r, &sp) || !ring_done(r);
+  rv += !ring_pop(r, &sp);               // empty and closed: not an underrun
+  rv += ring_underruns(r) != 1;
+  printf("Single thread: %s\n", rv ? "FAILED" : "OK");
+  ring_free(r);
+
+  // two threads: every setpoint arrives once, in order
+  r = ring_new(1024);
+  if (pthread_create(&tid, NULL, producer, r)) {
+    perror("Could not start the producer");
+    return 1;
+  }
+  while (!ring_done(r)) {
+    if (ring_pop(r, &sp))
+      continue;
+    if (sp.n != expected || sp.t != (data_t)expected) {
+      printf("Setpoint %zu received as %zu\n", expected, sp.n);
+      rv++;
+      break;
+    }
+    expected++;
+  }
+  pthread_join(tid, NULL);
+  rv += expected != N || ring_size(r) != 0 || ring_high_water(r) > 1024;
+  printf("Two threads: %zu of %d setpoints in order, high water %zu, "
+         "%zu underruns: %s\n",
+         expected, N, ring_high_water(r), ring_underruns(r),
+         rv ? "FAILED" : "OK");
+  ring_free(r);
+  return rv;
+}
+#endif
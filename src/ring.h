@@ -0,0 +1,67 @@
+//   ____  _
+//  |  _ \(_)_ __   __ _
+//  | |_) | | '_ \ / _` |
+//  |  _ <| | | | | (_| |
+//  |_| \_\_|_| |_|\__, |
+//                 |___/
+//  Lock-free setpoint queue
+
+#ifndef RING_H
+#define RING_H
+
+#include "defines.h"
+#include "executor.h"
+
+//   _____
+//  |_   _|   _ _ __   ___  ___
+//    | || | | | '_ \ / _ \/ __|
+//    | || |_| | |_) |  __/\__ \
+//    |_| \__, | .__/ \___||___/
+//        |___/|_|
+
+// Opaque structure: a bounded FIFO of setpoints, for exactly one producer
+// thread and one consumer thread. Neither side ever blocks nor takes locks:
+// pushing to a full ring and popping from an empty one just fail
+typedef struct ring ring_t;
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+// Ring of at least capacity setpoints (rounded up to a power of two)
+ring_t *ring_new(size_t capacity);
+void ring_free(ring_t *r);
+
+// PRODUCER ====================================================================
+
+// Append a setpoint; returns 1 if the ring is full (nothing is appended)
+int ring_push(ring_t *r, const executor_setpoint_t *sp);
+// No more setpoints will be pushed
+void ring_close(ring_t *r);
+
+// CONSUMER ====================================================================
+
+// Take the oldest setpoint; returns 1 if the ring is empty. Popping from an
+// empty ring that is not closed is an underrun (the producer is late)
+int ring_pop(ring_t *r, executor_setpoint_t *sp);
+// True once the ring is closed and empty: there will be no more setpoints
+int ring_done(ring_t *r);
+
+// GETTERS =====================================================================
+// Safe from any thread
+
+size_t ring_capacity(const ring_t *r);
+// Setpoints in the ring now
+size_t ring_size(const ring_t *r);
+// Most setpoints ever in the ring
+size_t ring_high_water(const ring_t *r);
+// Failed pops while the ring was open
+size_t ring_underruns(const ring_t *r);
+
+
+#endif // RING_H
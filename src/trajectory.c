@@ -0,0 +1,255 @@
+//   _____           _           _
+//  |_   _| __ __ _ (_) ___  ___| |_ ___  _ __ _   _
+//    | || '__/ _` || |/ _ \/ __| __/ _ \| '__| | | |
+//    | || | | (_| || |  __/ (__| || (_) | |  | |_| |
+//    |_||_|  \__,_|/ |\___|\___|\__\___/|_|   \__, |
+//                |__/                         |___/
+// trajectory.c
+
+#include "trajectory.h"
+#include "block.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+//   ____            _                 _   _
+//  |  _ \  ___  ___| | __ _ _ __ __ _| |_(_) ___  _ __  ___
+//  | | | |/ _ \/ __| |/ _` | '__/ _` | __| |/ _ \| '_ \/ __|
+//  | |_| |  __/ (__| | (_| | | | (_| | |_| | (_) | | | \__ \
+//  |____/ \___|\___|_|\__,_|_|  \__,_|\__|_|\___/|_| |_|___/
+
+// Header of the trajectory file, followed by count records of width data_t
+// values each. Its size is a multiple of 8, so that records are aligned
+#define TRAJ_MAGIC "CCNCT\0\0"
+#define TRAJ_VERSION 1
+typedef struct {
+  char magic[8];      // TRAJ_MAGIC
+  uint32_t version;   // TRAJ_VERSION
+  uint16_t data_size; // sizeof(data_t)
+  uint16_t width;     // values in each record
+  uint32_t layout;    // fields in each record
+  uint32_t pad;
+  data_t tq;          // sampling time
+  uint64_t count;     // number of records
+} trajectory_header_t;
+
+// Trajectory object structure
+typedef struct trajectory {
+  void *map;                  // mapped file
+  size_t len;                 // length of the mapping
+  const trajectory_header_t *h;
+  const data_t *data;         // first record
+  int offset[TRAJ_FIELDS];    // position of each field in a record, or -1
+} trajectory_t;
+
+// Samples rendered at once
+#define TRAJ_CHUNK 256
+
+// STATIC FUNCTIONS (for internal use only) ====================================
+static size_t trajectory_offsets(unsigned int layout, int offset[]);
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+int trajectory_render(program_t *p, const machine_t *cfg, const char *path,
+                      unsigned int layout) {
+  assert(p && cfg && path);
+  trajectory_header_t h;
+  int offset[TRAJ_FIELDS];
+  data_t lambda[TRAJ_CHUNK], feed[TRAJ_CHUNK];
+  data_t x[TRAJ_CHUNK], y[TRAJ_CHUNK], z[TRAJ_CHUNK];
+  data_t rec[TRAJ_CHUNK * TRAJ_FIELDS], t0, *v;
+  block_trajectory_t out = {NULL, lambda, feed, x, y, z};
+  block_t *b;
+  size_t i, j, k, m, n = 0, width;
+  char *tmp;
+  FILE *f;
+  int rv = EXIT_SUCCESS;
+
+  if (!layout || (layout >> TRAJ_FIELDS)) {
+    fprintf(stderr, "ERROR: invalid trajectory layout %#x\n", layout);
+    return EXIT_FAILURE;
+  }
+  width = trajectory_offsets(layout, offset);
+
+  // first pass: count the samples, so that the header is final
+  program_reset(p);
+  for (t0 = 0; (b = program_next(p));) {
+    n += block_samples(b, t0);
+    t0 = block_carry(b, t0);
+  }
+  if (program_failed(p))
+    return EXIT_FAILURE;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TRAJ_MAGIC, sizeof(h.magic));
+  h.version = TRAJ_VERSION;
+  h.data_size = sizeof(data_t);
+  h.width = width;
+  h.layout = layout;
+  h.tq = machine_tq(cfg);
+  h.count = n;
+
+  if (asprintf(&tmp, "%s.%d", path, (int)getpid()) == -1)
+    return EXIT_FAILURE;
+  if (!(f = fopen(tmp, "wb"))) {
+    perror("Error opening trajectory file");
+    free(tmp);
+    return EXIT_FAILURE;
+  }
+  if (fwrite(&h, sizeof(h), 1, f) != 1)
+    rv = EXIT_FAILURE;
+
+  // second pass: render each block a chunk at a time, interleave the fields
+  // into records and append them
+  program_reset(p);
+  for (t0 = 0, n = 0; rv == EXIT_SUCCESS && (b = program_next(p));) {
+    for (k = 0; (m = block_render(b, t0, k, TRAJ_CHUNK, &out)); k += m) {
+      for (i = 0, v = rec; i < m; i++, v += width) {
+        j = 0;
+        if (layout & TRAJ_T) v[j++] = (n + k + i) * h.tq;
+        if (layout & TRAJ_BLOCK) v[j++] = block_n(b);
+        if (layout & TRAJ_LAMBDA) v[j++] = lambda[i];
+        if (layout & TRAJ_FEED) v[j++] = feed[i];
+        if (layout & TRAJ_X) v[j++] = x[i];
+        if (layout & TRAJ_Y) v[j++] = y[i];
+        if (layout & TRAJ_Z) v[j++] = z[i];
+      }
+      if (fwrite(rec, sizeof(data_t) * width, m, f) != m) {
+        rv = EXIT_FAILURE;
+        break;
+      }
+    }
+    n += k;
+    t0 = block_carry(b, t0);
+  }
+  if (rv == EXIT_SUCCESS && program_failed(p))
+    rv = EXIT_FAILURE;
+  if (rv == EXIT_SUCCESS && n != h.count) {
+    fprintf(stderr, "ERROR: rendered %zu samples out of %zu\n", n,
+            (size_t)h.count);
+    rv = EXIT_FAILURE;
+  }
+  if (fclose(f))
+    rv = EXIT_FAILURE;
+  if (rv == EXIT_SUCCESS && rename(tmp, path))
+    rv = EXIT_FAILURE;
+  if (rv != EXIT_SUCCESS) {
+    fprintf(stderr, "ERROR: could not write trajectory file %s\n", path);
+    unlink(tmp);
+  }
+  free(tmp);
+  return rv;
+}
+
+trajectory_t *trajectory_open(const char *path) {
+  assert(path);
+  trajectory_t *t;
+  trajectory_header_t h;
+  struct stat st;
+  size_t width;
+  int fd, offset[TRAJ_FIELDS];
+
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    perror("Error opening trajectory file");
+    return NULL;
+  }
+  if (pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+      memcmp(h.magic, TRAJ_MAGIC, sizeof(h.magic)) ||
+      h.version != TRAJ_VERSION || h.data_size != sizeof(data_t) ||
+      !h.layout || (h.layout >> TRAJ_FIELDS) ||
+      (width = trajectory_offsets(h.layout, offset)) != h.width ||
+      fstat(fd, &st) || (size_t)st.st_size < sizeof(h) ||
+      // count is checked before multiplying, which could overflow
+      h.count > ((size_t)st.st_size - sizeof(h)) / (width * sizeof(data_t)) ||
+      (size_t)st.st_size != sizeof(h) + h.count * width * sizeof(data_t)) {
+    fprintf(stderr, "ERROR: %s is not a valid trajectory file\n", path);
+    close(fd);
+    return NULL;
+  }
+  if (!(t = malloc(sizeof(*t)))) {
+    perror("Error creating a trajectory");
+    close(fd);
+    return NULL;
+  }
+  // MAP_POPULATE reads the whole file now: playback must not page fault
+  t->len = st.st_size;
+  t->map = mmap(NULL, t->len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (t->map == MAP_FAILED) {
+    perror("Error mapping trajectory file");
+    free(t);
+    return NULL;
+  }
+  madvise(t->map, t->len, MADV_SEQUENTIAL);
+  t->h = t->map;
+  t->data = (const data_t *)((const char *)t->map + sizeof(h));
+  memcpy(t->offset, offset, sizeof(offset));
+  return t;
+}
+
+void trajectory_free(trajectory_t *t) {
+  assert(t);
+  munmap(t->map, t->len);
+  free(t);
+}
+
+// ACCESSORS ===================================================================
+
+size_t trajectory_count(const trajectory_t *t) {
+  assert(t);
+  return t->h->count;
+}
+
+data_t trajectory_tq(const trajectory_t *t) {
+  assert(t);
+  return t->h->tq;
+}
+
+unsigned int trajectory_layout(const trajectory_t *t) {
+  assert(t);
+  return t->h->layout;
+}
+
+size_t trajectory_width(const trajectory_t *t) {
+  assert(t);
+  return t->h->width;
+}
+
+int trajectory_offset(const trajectory_t *t, trajectory_field_t field) {
+  assert(t);
+  for (unsigned int i = 0; i < TRAJ_FIELDS; i++) {
+    if (field == (1u << i))
+      return t->offset[i];
+  }
+  return -1;
+}
+
+const data_t *trajectory_record(const trajectory_t *t, size_t i) {
+  assert(t && i < t->h->count);
+  return t->data + i * t->h->width;
+}
+
+
+
+//   ____  _        _   _         __
+//  / ___|| |_ __ _| |_(_) ___   / _|_   _ _ __   ___
+//  \___ \| __/ _` | __| |/ __| | |_| | | | '_ \ / __|
+//   ___) | || (_| | |_| | (__  |  _| |_| | | | | (__
+//  |____/ \__\__,_|\__|_|\___| |_|  \__,_|_| |_|\___|
+// Definitions for the static functions declared above
+
+// Position of each field within a record, and record width
+static size_t trajectory_offsets(unsigned int layout, int offset[]) {
+  size_t width = 0;
+  for (int i = 0; i < TRAJ_FIELDS; i++)
+    offset[i] = (layout & (1u << i)) ? (int)width++ : -1;
+  return width;
+}
@@ -0,0 +1,82 @@
+//   _____           _           _
+//  |_   _| __ __ _ (_) ___  ___| |_ ___  _ __ _   _
+//    | || '__/ _` || |/ _ \/ __| __/ _ \| '__| | | |
+//    | || | | (_| || |  __/ (__| || (_) | |  | |_| |
+//    |_||_|  \__,_|/ |\___|\___|\__\___/|_|   \__, |
+//                |__/                         |___/
+//  Pre-rendered setpoints
+
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include "defines.h"
+#include "machine.h"
+#include "program.h"
+
+//   _____
+//  |_   _|   _ _ __   ___  ___
+//    | || | | | '_ \ / _ \/ __|
+//    | || |_| | |_) |  __/\__ \
+//    |_| \__, | .__/ \___||___/
+//        |___/|_|
+
+// Opaque structure: a trajectory file mapped in memory.
+// The file holds the setpoints of a whole program sampled every tq: a header
+// followed by fixed-size records, one per sample. Sample k is at time k * tq
+// from the program start; rapid blocks are not sampled (as in block_render),
+// so the setpoint jumps to the rapid target.
+typedef struct trajectory trajectory_t;
+
+// Fields of a record, as bits of the layout. A record holds the selected
+// fields only, as data_t values, in the order below
+typedef enum {
+  TRAJ_T = 1 << 0,      // time from the program start
+  TRAJ_BLOCK = 1 << 1,  // block number (N word)
+  TRAJ_LAMBDA = 1 << 2, // curvilinear abscissa within the block
+  TRAJ_FEED = 1 << 3,   // actual feedrate (mm/min)
+  TRAJ_X = 1 << 4,      // position
+  TRAJ_Y = 1 << 5,
+  TRAJ_Z = 1 << 6
+} trajectory_field_t;
+
+#define TRAJ_FIELDS 7
+#define TRAJ_XYZ (TRAJ_X | TRAJ_Y | TRAJ_Z)
+#define TRAJ_DEFAULT (TRAJ_BLOCK | TRAJ_FEED | TRAJ_XYZ)
+
+
+//   _____                 _   _
+//  |  ___|   _ _ __   ___| |_(_) ___  _ __  ___
+//  | |_ | | | | '_ \ / __| __| |/ _ \| '_ \/ __|
+//  |  _|| |_| | | | | (__| |_| | (_) | | | \__ \
+//  |_|   \__,_|_| |_|\___|\__|_|\___/|_| |_|___/
+
+// LIFECYCLE ===================================================================
+
+// Sample a parsed program every machine_tq and write the fields in layout
+// (see trajectory_field_t) to a trajectory file at path. The file is written
+// to a temporary file first, then renamed. Returns EXIT_SUCCESS/EXIT_FAILURE
+int trajectory_render(program_t *p, const machine_t *cfg, const char *path,
+                      unsigned int layout);
+
+// Map a trajectory file (read only). Returns NULL if the file is missing,
+// truncated or was written with a different data_t
+trajectory_t *trajectory_open(const char *path);
+void trajectory_free(trajectory_t *t);
+
+// ACCESSORS ===================================================================
+
+// Number of records
+size_t trajectory_count(const trajectory_t *t);
+// Sampling time
+data_t trajectory_tq(const trajectory_t *t);
+// Fields in each record (see trajectory_field_t)
+unsigned int trajectory_layout(const trajectory_t *t);
+// Number of data_t values in each record
+size_t trajectory_width(const trajectory_t *t);
+// Position of field within each record, or -1 if it is not in the layout
+int trajectory_offset(const trajectory_t *t, trajectory_field_t field);
+// Record i, i.e. trajectory_width values (i must be less than count)
+const data_t *trajectory_record(const trajectory_t *t, size_t i);
+
+
+#endif // TRAJECTORY_H